@@ -0,0 +1,383 @@
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "game.h"
+#include "saved_states.h"
+#include "search.h"
+#include "symmetries.h"
+#include "thread_pool.h"
+#include "xoshiro.h"
+
+/**
+ * Plays random selections and placements from the empty board, stops early when a quarto is made
+ */
+quarto::game random_game(std::mt19937& rng, const int moves)
+{
+    constexpr uint16_t boardState[5]{};
+    auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+
+    for (int i = 0; i < moves; ++i)
+    {
+        const uint16_t selection_board = game.get_selection_state();
+        int nth = static_cast<int>(rng() % std::popcount(selection_board));
+        uint8_t selection_index = 0;
+        while ((selection_board & (0x8000 >> selection_index)) == 0 || nth-- != 0)
+        {
+            ++selection_index;
+        }
+        game.do_select(selection_index);
+
+        const uint16_t empty_board = ~game.get_board_state()[quarto::game::BOARD_PLACED];
+        nth = static_cast<int>(rng() % std::popcount(empty_board));
+        uint8_t placement_index = 0;
+        while ((empty_board & (0x8000 >> placement_index)) == 0 || nth-- != 0)
+        {
+            ++placement_index;
+        }
+        game.do_move(placement_index);
+
+        if (game.is_quarto())
+        {
+            break;
+        }
+    }
+
+    return game.clone();
+}
+
+template <typename F>
+double time_per_call_ns(const std::vector<quarto::game>& games, const int rounds, F&& f)
+{
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (const auto& game : games)
+        {
+            f(game);
+        }
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::high_resolution_clock::now() - start).count();
+
+    return static_cast<double>(elapsed) / (static_cast<double>(rounds) * games.size());
+}
+
+void bench_canonize()
+{
+    std::mt19937 rng(42);
+    std::vector<quarto::game> games;
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        games.push_back(random_game(rng, static_cast<int>(rng() % 17)));
+    }
+
+    // make sure both agree before timing anything
+    for (const auto& game : games)
+    {
+        if (game.canonize() != game.canonize_reference())
+        {
+            std::cerr << "canonize and canonize_reference disagree" << std::endl;
+            std::exit(1);
+        }
+    }
+
+    __uint128_t sink = 0;
+    const auto reference_ns = time_per_call_ns(games, 5, [&](const auto& game) { sink ^= game.canonize_reference(); });
+    const auto table_ns = time_per_call_ns(games, 50, [&](const auto& game) { sink ^= game.canonize(); });
+
+    std::cout << "canonize_reference: " << reference_ns << " ns/call" << std::endl;
+    std::cout << "canonize:           " << table_ns << " ns/call" << std::endl;
+    std::cout << "speedup:            " << reference_ns / table_ns << "x" << " (" << static_cast<int>(sink & 1) << ")"
+        << std::endl;
+
+    // the symmetry kernels on their own, with the candidates already computed
+    struct kernel_input
+    {
+        uint16_t placed;
+        uint16_t candidates[MAX_ATTRIBUTE_CANDIDATES][4];
+        int candidate_count;
+    };
+
+    std::vector<kernel_input> inputs(games.size());
+    for (size_t i = 0; i < games.size(); ++i)
+    {
+        auto game = games[i];
+        inputs[i].placed = game.get_board_state()[quarto::game::BOARD_PLACED];
+        inputs[i].candidate_count = quarto::get_attribute_candidates(game.get_board_state(), inputs[i].candidates);
+    }
+
+    auto time_kernel = [&](auto kernel)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+        for (int round = 0; round < 50; ++round)
+        {
+            for (const auto& input : inputs)
+            {
+                sink ^= kernel(input.placed, input.candidates, input.candidate_count);
+            }
+        }
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::high_resolution_clock::now() - start).count()) / (50.0 * inputs.size());
+    };
+
+    const auto scalar_ns = time_kernel(quarto::symmetries::board::minimal_key_scalar);
+    std::cout << "minimal_key_scalar: " << scalar_ns << " ns/call" << std::endl;
+
+    if (quarto::symmetries::board::has_avx2_kernel())
+    {
+        const auto avx2_ns = time_kernel(quarto::symmetries::board::minimal_key_avx2);
+        std::cout << "minimal_key_avx2:   " << avx2_ns << " ns/call (" << scalar_ns / avx2_ns << "x)" << std::endl;
+    }
+    else
+    {
+        std::cout << "minimal_key_avx2:   not supported on this cpu" << std::endl;
+    }
+}
+
+void bench_solve()
+{
+    std::mt19937 rng(3);
+    std::vector<quarto::game> games;
+
+    // 9 empty squares with a piece to place, the endgame solves search_iterative spends its time on
+    while (games.size() < 50)
+    {
+        auto game = random_game(rng, 7);
+        if (game.is_quarto() || std::popcount(game.get_board_state()[quarto::game::BOARD_PLACED]) != 7)
+        {
+            continue;
+        }
+        game.do_select(std::countl_zero(game.get_selection_state()));
+        games.push_back(game.clone());
+    }
+
+    auto time_solve = [&games](const bool null_window, uint64_t& searched)
+    {
+        const auto start_nodes = quarto::search::searched_nodes();
+        const auto ns = time_per_call_ns(games, 1, [null_window](const auto& game)
+        {
+            // every position from an empty table, so only the table reuse within one solve counts
+            saved_states::get_instance()->clear();
+            auto position = game.clone();
+            quarto::search::solve(position, null_window);
+        });
+        searched = quarto::search::searched_nodes() - start_nodes;
+        return ns;
+    };
+
+    // serial, the nodes of split off moves would be counted on the workers
+    quarto::search::set_split_min_empties(17);
+
+    uint64_t full_nodes = 0;
+    uint64_t null_nodes = 0;
+    const auto full_ns = time_solve(false, full_nodes);
+    const auto null_ns = time_solve(true, null_nodes);
+
+    std::cout << "full window solve: " << full_ns / 1000000.0 << " ms/position, " << full_nodes / games.size()
+        << " nodes/position" << std::endl;
+    std::cout << "null window solve: " << null_ns / 1000000.0 << " ms/position, " << null_nodes / games.size()
+        << " nodes/position (" << full_ns / null_ns << "x)" << std::endl;
+
+    // every combination of the move ordering heuristics, the killers and history carry over from position to position
+    for (uint8_t heuristics = 0; heuristics <= (ORDER_HASH_MOVE | ORDER_KILLERS | ORDER_HISTORY); ++heuristics)
+    {
+        quarto::search::set_move_ordering(heuristics);
+        uint64_t ordered_nodes = 0;
+        const auto ordered_ns = time_solve(true, ordered_nodes);
+
+        std::cout << "null window solve ordered by" << ((heuristics & ORDER_HASH_MOVE) != 0 ? " hash move" : "")
+            << ((heuristics & ORDER_KILLERS) != 0 ? " killers" : "")
+            << ((heuristics & ORDER_HISTORY) != 0 ? " history" : "") << (heuristics == 0 ? " index" : "") << ": "
+            << ordered_ns / 1000000.0 << " ms/position, " << ordered_nodes / games.size() << " nodes/position"
+            << std::endl;
+    }
+    quarto::search::set_move_ordering(DEFAULT_MOVE_ORDERING);
+
+    quarto::search::set_split_min_empties(DEFAULT_SPLIT_MIN_EMPTIES);
+}
+
+/**
+ * The rollout search_mnt used before search::playout, for comparison: generates every move of every ply to find the
+ * winning ones and picks with std::rand
+ */
+int rollout_reference(quarto::game& game_state)
+{
+    while (!game_state.is_game_over() && !game_state.is_quarto())
+    {
+        if (game_state.move_count() == 0)
+            break;
+
+        const auto winning_squares = game_state.winning_squares(game_state.get_selection_piece());
+
+        quarto::move_list legal_moves;
+        quarto::move_list winning_moves;
+        game_state.generate_moves(legal_moves);
+
+        for (const auto move : legal_moves)
+        {
+            if ((winning_squares & (0x8000 >> (move >> 4))) != 0)
+            {
+                winning_moves.push_back(move >> 4, move & 0xf);
+            }
+        }
+
+        const auto& picked_from = winning_moves.empty() ? legal_moves : winning_moves;
+        const auto move = picked_from.moves[std::rand() % picked_from.size];
+        game_state.do_move(move >> 4);
+        game_state.do_select(move & 0xf);
+    }
+
+    return quarto::search::eval(game_state);
+}
+
+void bench_playouts()
+{
+    std::mt19937 rng(11);
+    std::vector<quarto::game> games;
+
+    // the positions monte carlo plays out from, up to where minimax takes over
+    while (games.size() < 1000)
+    {
+        auto game = random_game(rng, static_cast<int>(rng() % MINIMAX_MIN_PLACED));
+        if (game.is_quarto())
+        {
+            continue;
+        }
+        game.do_select(std::countl_zero(game.get_selection_state()));
+        games.push_back(game.clone());
+    }
+
+    int sink = 0;
+    const auto reference_ns = time_per_call_ns(games, 20, [&](const auto& game)
+    {
+        auto position = game.clone();
+        sink += rollout_reference(position);
+    });
+
+    quarto::xoshiro256 playout_rng(1);
+    const auto playout_ns = time_per_call_ns(games, 200, [&](const auto& game)
+    {
+        sink += quarto::search::playout(game.get_position(), 1, playout_rng);
+    });
+
+    std::cout << "rollout_reference: " << reference_ns << " ns/playout" << std::endl;
+    std::cout << "playout:           " << playout_ns << " ns/playout (" << reference_ns / playout_ns << "x, "
+        << sink % 2 << ")" << std::endl;
+}
+
+void bench_mcts()
+{
+    constexpr uint16_t boardState[5]{};
+    auto empty = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+    empty.do_select(0);
+
+    std::mt19937 rng(5);
+    auto middle = random_game(rng, 5);
+    while (middle.is_quarto() || std::popcount(middle.get_board_state()[quarto::game::BOARD_PLACED]) != 5)
+    {
+        middle = random_game(rng, 5);
+    }
+    middle.do_select(std::countl_zero(middle.get_selection_state()));
+
+    const quarto::game positions[]{empty.clone(), middle.clone()};
+    const char* names[]{"empty board", "5 pieces"};
+    constexpr int search_time = 2000;
+
+    // every thread count the pool has up to doubling, with and without virtual loss and with batches of playouts
+    const auto max_threads = quarto::thread_pool::get_instance().get_thread_count();
+    for (size_t threads = 1;; threads = std::min(threads * 2, max_threads))
+    {
+        quarto::search::set_mcts_threads(threads);
+        for (const int loss : {0, DEFAULT_VIRTUAL_LOSS})
+        {
+            quarto::search::set_virtual_loss(loss);
+            for (const int per_leaf : {1, 4, 16, 64})
+            {
+                quarto::search::set_playouts_per_leaf(per_leaf);
+                for (int i = 0; i < 2; ++i)
+                {
+                    auto position = positions[i].clone();
+                    const auto start_playouts = quarto::search::mcts_playouts();
+                    quarto::search::search_mnt(position, search_time);
+                    const auto searched = quarto::search::mcts_playouts() - start_playouts;
+
+                    std::cout << "monte carlo " << names[i] << ", " << threads << " threads, virtual loss " << loss
+                        << ", " << per_leaf << " playouts per leaf: " << searched * 1000 / search_time << " playouts/s"
+                        << std::endl;
+                }
+            }
+        }
+
+        if (threads == max_threads)
+        {
+            break;
+        }
+    }
+
+    quarto::search::set_mcts_threads(0);
+    quarto::search::set_virtual_loss(DEFAULT_VIRTUAL_LOSS);
+    quarto::search::set_playouts_per_leaf(DEFAULT_PLAYOUTS_PER_LEAF);
+}
+
+/**
+ * The tree and the transposition aware dag on the same positions, both print how many nodes they ended up with
+ */
+void bench_mcts_dag()
+{
+    constexpr uint16_t boardState[5]{};
+    auto empty = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+    empty.do_select(0);
+
+    std::mt19937 rng(5);
+    auto middle = random_game(rng, 4);
+    while (middle.is_quarto() || std::popcount(middle.get_board_state()[quarto::game::BOARD_PLACED]) != 4)
+    {
+        middle = random_game(rng, 4);
+    }
+    middle.do_select(std::countl_zero(middle.get_selection_state()));
+
+    const quarto::game positions[]{empty.clone(), middle.clone()};
+    const char* names[]{"empty board", "4 pieces"};
+    constexpr int search_time = 2000;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        for (const bool dag : {false, true})
+        {
+            auto position = positions[i].clone();
+            const auto start_playouts = quarto::search::mcts_playouts();
+            if (dag)
+            {
+                quarto::search::search_dag(position, search_time);
+            }
+            else
+            {
+                quarto::search::search_mnt(position, search_time);
+            }
+            const auto searched = quarto::search::mcts_playouts() - start_playouts;
+
+            std::cout << "monte carlo " << (dag ? "dag " : "tree ") << names[i] << ": " << searched * 1000 / search_time
+                << " playouts/s" << std::endl;
+        }
+    }
+}
+
+int main()
+{
+    std::cout << "Starting benchmarks" << std::endl;
+    bench_canonize();
+    bench_solve();
+    bench_playouts();
+    bench_mcts();
+    bench_mcts_dag();
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "position_book.h"
+#include "saved_states.h"
+
+/**
+ * Converts a .shmx state file to the memory mapped book format, or compacts the result log of a book into it
+ *
+ * usage: book_convert <input.shmx> <output.shmb>
+ *        book_convert --compact <name>    merges name.shml into name.shmb and empties name.shml
+ */
+int main(const int argc, char** argv)
+{
+    if (argc == 3 && std::strcmp(argv[1], "--compact") == 0)
+    {
+        // only the book and the log are merged, the table of this process has nothing in it
+        saved_states states;
+        states.resize_table(1);
+        states.load(argv[2]);
+
+        if (!states.compact(argv[2]))
+        {
+            return 1;
+        }
+
+        std::cout << "compacted " << argv[2] << LOG_FILE_EXTENSION << " into " << states.get_book_size()
+            << " records" << std::endl;
+        return 0;
+    }
+
+    if (argc != 3)
+    {
+        std::cerr << "usage: " << argv[0] << " <input.shmx> <output" << BOOK_FILE_EXTENSION << ">" << std::endl;
+        std::cerr << "       " << argv[0] << " --compact <name>" << std::endl;
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "error opening " << argv[1] << std::endl;
+        return 1;
+    }
+
+    const std::vector<u_char> data(std::istreambuf_iterator<char>(file), {});
+    std::vector<position_book::record> records;
+
+    if (!saved_states::for_each_record(data, [&records](const __uint128_t state, const uint8_t selection,
+                                                        const int8_t eval)
+    {
+        records.push_back(position_book::record{state, selection, eval});
+    }))
+    {
+        std::cerr << argv[1] << " is not a version " << STATE_FILE_VERSION << " state file" << std::endl;
+        return 1;
+    }
+
+    const auto record_count = records.size();
+    if (!position_book::write(argv[2], std::move(records)))
+    {
+        return 1;
+    }
+
+    std::cout << "converted " << record_count << " records to " << argv[2] << std::endl;
+
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <bit>
 #include <cassert>
 #include <iostream>
 #include <ostream>
@@ -12,30 +13,34 @@
 
 namespace quarto
 {
+    game::game(const position& state) : state(state)
+    {
+    }
+
     game::game(const uint16_t board_state[], uint16_t selection_state, int selected_piece)
     {
         for (int i = 0; i < 5; ++i)
         {
-            this->board_state[i] = board_state[i];
+            this->state.board_state[i] = board_state[i];
         }
-        this->selection_state = selection_state;
-        this->selected_piece = selected_piece;
+        this->state.selection_state = selection_state;
+        this->state.selected_piece = selected_piece;
+        this->state.recompute_lines();
 
         // this->print_state();
         // std::cout << "selected piece: " << selected_piece << "selection state: " << selection_state << std::endl;
     }
 
     /**
-     * Does a move on the board
+     * Copy-make version of game::do_move, the position itself is left untouched
      * @param square the square to place the selected piece to. The square must be between 0 and 15
      */
-    void game::do_move(const uint8_t square)
+    position position::with_move(const uint8_t square) const
     {
-        push_state_to_undo_stack();
-
         assert(square < 16);
         assert(this->selected_piece != INVALID_PIECE_SELECTION);
 
+        position next = *this;
         const uint8_t piece = QUARTO_PIECES[this->selected_piece];
         const uint16_t squareBin = 0x8000 >> square;
 
@@ -43,21 +48,55 @@ namespace quarto
         {
             if ((piece & 0x8 >> i) == 0x8 >> i)
             {
-                this->board_state[i] |= squareBin;
+                next.board_state[i] |= squareBin;
+            }
+        }
+
+        next.board_state[4] |= squareBin; // set that square is activated
+        next.selected_piece = INVALID_PIECE_SELECTION;
+
+        // only the lines through the square can change
+        const uint8_t piece_attributes = PIECE_LINE_ATTRIBUTES[this->selected_piece];
+        for (uint16_t lines = SQUARE_LINES[square]; lines != 0; lines &= lines - 1)
+        {
+            const int line = std::countr_zero(lines);
+            next.line_shared[line] &= piece_attributes;
+
+            if ((next.board_state[4] & QUARTO_MAGIC_VALUES[line]) == QUARTO_MAGIC_VALUES[line] &&
+                next.line_shared[line] != 0)
+            {
+                next.quarto = true;
             }
         }
 
-        this->board_state[4] |= squareBin; // set that square is activated
-        this->selected_piece = INVALID_PIECE_SELECTION;
+        return next;
     }
 
-    void game::do_select(const uint8_t new_selection)
+    position position::with_select(const uint8_t new_selection) const
+    {
+        assert(new_selection < 16);
+
+        position next = *this;
+        next.selection_state &= ~(0x8000 >> new_selection);
+        next.selected_piece = new_selection;
+
+        return next;
+    }
+
+    /**
+     * Does a move on the board
+     * @param square the square to place the selected piece to. The square must be between 0 and 15
+     */
+    void game::do_move(const uint8_t square)
     {
         push_state_to_undo_stack();
+        this->state = this->state.with_move(square);
+    }
 
-        assert(new_selection < 16);
-        this->selection_state &= ~(0x8000 >> new_selection);
-        this->selected_piece = new_selection;
+    void game::do_select(const uint8_t new_selection)
+    {
+        push_state_to_undo_stack();
+        this->state = this->state.with_select(new_selection);
     }
 
     // non index based selection ONLY USE THIS ONE FOR TESTS
@@ -77,28 +116,190 @@ namespace quarto
 
     void game::push_state_to_undo_stack()
     {
-        for (int i = 0; i < 5; ++i)
+        assert(previous_states_size < MAX_UNDO_PLIES);
+        previous_states[previous_states_size++] = this->state;
+    }
+
+    void game::undo()
+    {
+        assert(previous_states_size > 0);
+        this->state = previous_states[--previous_states_size];
+    }
+
+    void game::generate_moves(move_list& moves) const
+    {
+        moves.size = 0;
+
+        for (uint16_t empty_squares = get_empty_squares(); empty_squares != 0;)
         {
-            // put them in reverse
-            previous_board_states.push(board_state[4 - i]);
+            const uint8_t placement = pop_square(empty_squares);
+
+            for (uint16_t pieces = this->state.selection_state; pieces != 0;)
+            {
+                moves.push_back(placement, pop_square(pieces));
+            }
         }
-        previous_selected_pieces.push(selected_piece);
-        previous_selection_states.push(selection_state);
     }
 
-    void game::undo()
+    void game::generate_safe_moves(move_list& moves) const
     {
-        selected_piece = previous_selected_pieces.top();
-        selection_state = previous_selection_states.top();
+        moves.size = 0;
 
-        for (int i = 0; i < 5; ++i)
+        for (uint16_t empty_squares = get_empty_squares(); empty_squares != 0;)
+        {
+            const uint8_t placement = pop_square(empty_squares);
+            const auto placed = this->state.with_move(placement);
+
+            for (uint16_t pieces = placed.selection_state & ~placed.poisoned_pieces(); pieces != 0;)
+            {
+                moves.push_back(placement, pop_square(pieces));
+            }
+        }
+    }
+
+    void game::remove_symmetric_moves(move_list& moves) const
+    {
+        const uint16_t* board = this->state.board_state;
+        const uint16_t placed = board[BOARD_PLACED];
+        const uint8_t selected = this->state.selected_piece;
+        assert(selected < 16);
+
+        // per placement the selections some symmetry maps to an earlier move
+        uint16_t duplicates[16]{};
+
+        // symmetry 0 is the identity, it maps every move to itself
+        for (int symmetry = 1; symmetry < symmetries::board::SYMMETRY_COUNT; ++symmetry)
+        {
+            if (symmetries::board::transform(symmetry, placed) != placed)
+            {
+                continue;
+            }
+
+            // bit 0 set if bitboard j lands on bitboard i as is, bit 1 if it lands there flipped
+            uint8_t fits[4][4]{};
+            uint8_t sources[4]{};
+            for (int j = 0; j < 4; ++j)
+            {
+                const uint16_t image = symmetries::board::transform(symmetry, board[j]);
+
+                for (int i = 0; i < 4; ++i)
+                {
+                    fits[i][j] = (image == board[i] ? 1 : 0) | ((image ^ placed) == board[i] ? 2 : 0);
+                    sources[i] |= fits[i][j] != 0 ? 1 << j : 0;
+                }
+            }
+
+            uint8_t square_images[16];
+            for (uint8_t square = 0; square < 16; ++square)
+            {
+                square_images[square] = std::countl_zero(symmetries::board::transform(symmetry, 0x8000 >> square));
+            }
+
+            // attribute i of an image is attribute source[i] of the piece, flipped if bit i of flips is set
+            auto mark_duplicates = [&](const int source[4], const int flips)
+            {
+                uint8_t piece_images[16];
+                for (uint8_t piece = 0; piece < 16; ++piece)
+                {
+                    uint8_t image = 0;
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        const bool has_attribute = (QUARTO_PIECES[piece] & 0x8 >> source[i]) != 0;
+                        image |= has_attribute != ((flips & 1 << i) != 0) ? 0x8 >> i : 0;
+                    }
+                    piece_images[piece] = PIECE_INDICES[image];
+                }
+
+                if (piece_images[selected] != selected)
+                {
+                    return;
+                }
+
+                for (const auto move : moves)
+                {
+                    const uint8_t image = (square_images[move >> 4] << 4) | piece_images[move & 0xf];
+                    if (image < move)
+                    {
+                        duplicates[move >> 4] |= 0x8000 >> (move & 0xf);
+                    }
+                }
+            };
+
+            auto mark_flips = [&](const int source[4])
+            {
+                // every flip combination the fits allow, an attribute fitting both ways can go either way
+                for (int flips = 0; flips < 16; ++flips)
+                {
+                    bool fitting = true;
+                    for (int i = 0; i < 4 && fitting; ++i)
+                    {
+                        fitting = (fits[i][source[i]] & ((flips & 1 << i) != 0 ? 2 : 1)) != 0;
+                    }
+
+                    if (fitting)
+                    {
+                        mark_duplicates(source, flips);
+                    }
+                }
+            };
+
+            for (uint8_t m0 = sources[0]; m0 != 0; m0 &= m0 - 1)
+            {
+                const int s0 = std::countr_zero(m0);
+                for (uint8_t m1 = sources[1] & ~(1 << s0); m1 != 0; m1 &= m1 - 1)
+                {
+                    const int s1 = std::countr_zero(m1);
+                    for (uint8_t m2 = sources[2] & ~(1 << s0 | 1 << s1); m2 != 0; m2 &= m2 - 1)
+                    {
+                        const int s2 = std::countr_zero(m2);
+                        for (uint8_t m3 = sources[3] & ~(1 << s0 | 1 << s1 | 1 << s2); m3 != 0; m3 &= m3 - 1)
+                        {
+                            const int source[4]{s0, s1, s2, std::countr_zero(m3)};
+                            mark_flips(source);
+                        }
+                    }
+                }
+            }
+        }
+
+        uint8_t kept = 0;
+        for (const auto move : moves)
+        {
+            if ((duplicates[move >> 4] & (0x8000 >> (move & 0xf))) == 0)
+            {
+                moves.moves[kept++] = move;
+            }
+        }
+        moves.size = kept;
+    }
+
+    void game::remove_transposed_moves(move_list& moves) const
+    {
+        __uint128_t keys[MAX_MOVES];
+        uint8_t selections[MAX_MOVES];
+        uint8_t kept = 0;
+
+        for (const auto move : moves)
         {
-            board_state[i] = previous_board_states.top();
-            previous_board_states.pop();
+            const auto child = game(this->state.with_move(move >> 4).with_select(move & 0xf));
+            uint8_t selection;
+            const auto key = child.canonize_with_selection(selection);
+
+            bool seen = false;
+            for (uint8_t i = 0; i < kept && !seen; ++i)
+            {
+                seen = keys[i] == key && selections[i] == selection;
+            }
+
+            if (!seen)
+            {
+                keys[kept] = key;
+                selections[kept] = selection;
+                moves.moves[kept++] = move;
+            }
         }
 
-        previous_selected_pieces.pop();
-        previous_selection_states.pop();
+        moves.size = kept;
     }
 
     void copy_array(const uint16_t board_state[5], uint16_t copy_to[5])
@@ -219,12 +420,14 @@ namespace quarto
         int vector_size = board_states.size();
         for (int vec_index = 0; vec_index < vector_size; vec_index++)
         {
-            auto& game_state_wrapper = board_states.at(vec_index);
-            auto& game_state = game_state_wrapper.bb;
+            // work on a copy, add_permutations grows the vector and would leave a reference dangling
+            uint16_t game_state[5];
+            copy_array(board_states.at(vec_index).bb, game_state);
             uint16_t last_num = game_state[0];
             int last_index = 0;
             std::sort(std::begin(game_state), std::end(game_state) - 1,
                       [](auto g1, auto g2) { return std::popcount(g1) > std::popcount(g2); });
+            copy_array(game_state, board_states.at(vec_index).bb);
 
             for (int i = 1; i < 4; ++i)
             {
@@ -247,13 +450,185 @@ namespace quarto
         }
     }
 
+    /**
+     * Allocation free equivalent of get_all_minimized_flips followed by get_sorted_bitboard. Writes every arrangement
+     * of the attribute bitboards (0 to 3) that canonize has to try, the placed bitboard is never touched by either.
+     *
+     * @return the number of candidates written
+     */
+    int get_attribute_candidates(const uint16_t board_state[5], uint16_t candidates[MAX_ATTRIBUTE_CANDIDATES][4])
+    {
+        uint16_t attributes[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            // a population of exactly 8 is kept as is, the copy get_all_minimized_flips adds for it is a duplicate
+            attributes[i] = std::popcount(board_state[i]) > 8
+                                ? static_cast<uint16_t>(~board_state[i])
+                                : board_state[i];
+        }
+
+        const uint16_t last_num = attributes[0];
+        int last_index = 0;
+        std::sort(std::begin(attributes), std::end(attributes),
+                  [](auto g1, auto g2) { return std::popcount(g1) > std::popcount(g2); });
+
+        int size = 0;
+        auto add_candidate = [&](const uint16_t arrangement[4])
+        {
+            assert(size < MAX_ATTRIBUTE_CANDIDATES);
+            std::copy_n(arrangement, 4, candidates[size++]);
+        };
+
+        auto add_permutations = [&](const int from, const int to)
+        {
+            uint16_t permutated[4];
+            std::copy_n(attributes, 4, permutated);
+
+            do
+            {
+                add_candidate(permutated);
+            }
+            while (std::next_permutation(permutated + from, permutated + to));
+        };
+
+        add_candidate(attributes);
+
+        // same grouping as get_sorted_bitboard
+        for (int i = 1; i < 4; ++i)
+        {
+            if (std::popcount(last_num) == std::popcount(attributes[i]))
+            {
+                continue;
+            }
+            if (last_index != i - 1)
+            {
+                add_permutations(last_index, i);
+            }
+
+            last_index = i;
+        }
+
+        if (last_index != 3)
+        {
+            add_permutations(last_index, 4);
+        }
+
+        return size;
+    }
+
     __uint128_t game::canonize() const
+    {
+        uint16_t candidates[MAX_ATTRIBUTE_CANDIDATES][4];
+        const int candidate_count = get_attribute_candidates(this->state.board_state, candidates);
+
+        return symmetries::board::minimal_key(this->state.board_state[BOARD_PLACED], candidates, candidate_count);
+    }
+
+    __uint128_t game::canonize_with_selection(uint8_t& selection) const
+    {
+        const __uint128_t key = canonize();
+        selection = this->state.selected_piece;
+
+        if (selection >= 16)
+        {
+            return key;
+        }
+
+        const uint16_t placed = this->state.board_state[BOARD_PLACED];
+        const auto min_placed = static_cast<uint16_t>(key >> 64);
+
+        // the board the key stands for, bitboards get_attribute_candidates flipped have their empty squares set
+        uint16_t canonical[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            const auto bitboard = static_cast<uint16_t>(key >> (16 * i));
+            canonical[i] = (bitboard & ~min_placed) != 0 ? static_cast<uint16_t>(~bitboard & min_placed) : bitboard;
+        }
+
+        // every attribute flip, attribute permutation and board symmetry taking the board to the canonical one is
+        // tried, including the flips the key does not show (like every flip of the empty board)
+        uint16_t reachable = 0;
+
+        for (int symmetry = 0; symmetry < symmetries::board::SYMMETRY_COUNT; ++symmetry)
+        {
+            if (symmetries::board::transform(symmetry, placed) != min_placed)
+            {
+                continue;
+            }
+
+            // for every bitboard of the canonical board and every bitboard of this one, bit 0 set if it lands there
+            // as is and bit 1 set if it lands there flipped
+            uint8_t fits[4][4]{};
+            uint8_t sources[4]{};
+            for (int j = 0; j < 4; ++j)
+            {
+                const uint16_t image = symmetries::board::transform(symmetry, this->state.board_state[j]);
+
+                for (int i = 0; i < 4; ++i)
+                {
+                    fits[i][j] = (image == canonical[i] ? 1 : 0) | ((image ^ min_placed) == canonical[i] ? 2 : 0);
+                    sources[i] |= fits[i][j] != 0 ? 1 << j : 0;
+                }
+            }
+
+            // bit n of the set stands for the attribute nibble n, every fitting bitboard adds its attribute as is,
+            // flipped or both
+            auto add_images = [&](const int source[4])
+            {
+                uint16_t images = 1;
+
+                for (int i = 0; i < 4; ++i)
+                {
+                    const bool has_attribute = (QUARTO_PIECES[selection] & 0x8 >> source[i]) != 0;
+                    const uint8_t fit = fits[i][source[i]];
+                    const bool can_have = (fit & (has_attribute ? 1 : 2)) != 0;
+                    const bool can_lack = (fit & (has_attribute ? 2 : 1)) != 0;
+
+                    images = static_cast<uint16_t>((can_have ? images << (0x8 >> i) : 0) | (can_lack ? images : 0));
+                }
+
+                reachable |= images;
+            };
+
+            for (uint8_t m0 = sources[0]; m0 != 0; m0 &= m0 - 1)
+            {
+                const int s0 = std::countr_zero(m0);
+                for (uint8_t m1 = sources[1] & ~(1 << s0); m1 != 0; m1 &= m1 - 1)
+                {
+                    const int s1 = std::countr_zero(m1);
+                    for (uint8_t m2 = sources[2] & ~(1 << s0 | 1 << s1); m2 != 0; m2 &= m2 - 1)
+                    {
+                        const int s2 = std::countr_zero(m2);
+                        for (uint8_t m3 = sources[3] & ~(1 << s0 | 1 << s1 | 1 << s2); m3 != 0; m3 &= m3 - 1)
+                        {
+                            const int source[4]{s0, s1, s2, std::countr_zero(m3)};
+                            add_images(source);
+                        }
+                    }
+                }
+            }
+        }
+
+        assert(reachable != 0);
+
+        uint8_t min_selection = 0xff;
+        for (uint16_t remaining = reachable; remaining != 0; remaining &= remaining - 1)
+        {
+            min_selection = std::min(min_selection, PIECE_INDICES[std::countr_zero(remaining)]);
+        }
+
+        selection = min_selection;
+
+        return key;
+    }
+
+    __uint128_t game::canonize_reference() const
     {
         uint16_t current_state[5]{};
 
         for (int i = 0; i < 5; ++i)
         {
-            current_state[i] = this->board_state[i];
+            current_state[i] = this->state.board_state[i];
         }
 
         std::vector<bb_wrapper> board_states{create_wrapper(current_state)};
@@ -267,49 +642,55 @@ namespace quarto
 
     bool game::is_game_over() const
     {
-        return selection_state == 0 && this->board_state[4] == 0xffff;
+        return this->state.selection_state == 0 && this->state.board_state[4] == 0xffff;
     }
 
     void game::print_state() const
     {
-        for (const uint16_t bs : this->board_state)
+        for (const uint16_t bs : this->state.board_state)
         {
             std::cout << "State: " << bs << std::endl;
         }
     }
 
-    bool game::is_quarto() const
+    void position::recompute_lines()
     {
-        for (int i = 0; i < 10; ++i)
+        this->quarto = false;
+
+        for (int line = 0; line < 10; ++line)
         {
-            const auto quarto_magic_value = QUARTO_MAGIC_VALUES[i];
+            const auto quarto_magic_value = QUARTO_MAGIC_VALUES[line];
+            uint8_t shared = 0xff;
 
-            if ((this->board_state[BOARD_PLACED] & quarto_magic_value) != quarto_magic_value)
+            for (int j = 0; j < 4; ++j)
             {
-                continue;
+                if ((this->board_state[j] & quarto_magic_value & this->board_state[4]) != 0)
+                {
+                    shared &= ~(1 << (4 + j)); // some piece on the line has the attribute
+                }
+
+                if ((~this->board_state[j] & quarto_magic_value & this->board_state[4]) != 0)
+                {
+                    shared &= ~(1 << j); // some piece on the line lacks the attribute
+                }
             }
 
+            this->line_shared[line] = shared;
 
-            for (int j = 0; j < 4; ++j)
+            if ((this->board_state[4] & quarto_magic_value) == quarto_magic_value && shared != 0)
             {
-                if ((this->board_state[j] & quarto_magic_value) == quarto_magic_value || (~this->board_state[j] &
-                    quarto_magic_value) == quarto_magic_value)
-                {
-                    return true;
-                }
+                this->quarto = true;
             }
         }
-
-        return false;
     }
 
-
     uint8_t game::compute_move(int time_remaining) const
     {
         auto start = std::chrono::high_resolution_clock::now();
 
         search root_node = search{};
-        auto result = root_node.selective_search(this->clone(), time_remaining);
+        auto game_copy = this->clone();
+        auto result = root_node.selective_search(game_copy, time_remaining);
 
         auto time_taken = std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::high_resolution_clock::now() - start)
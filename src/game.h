@@ -1,16 +1,20 @@
 #ifndef SHMINIMAXING_GAME_H
 #define SHMINIMAXING_GAME_H
 
+#include <array>
+#include <bit>
 #include <cstdint>
+#include <type_traits>
 #include <initializer_list>
 #include <list>
 #include <cassert>
 #include <memory>
-#include <stack>
 #include <vector>
 
 #define DEFAULT_GAME_SELECTION_STATE 0xffff
 #define INVALID_PIECE_SELECTION 0x67
+#define MAX_ATTRIBUTE_CANDIDATES 25
+#define MAX_MOVES 240 // 16 placements * 15 selections
 
 namespace quarto
 {
@@ -23,6 +27,7 @@ namespace quarto
     void add_permutations(std::vector<bb_wrapper>& board_states, unsigned short* game_state, int last_index, int i);
     __uint128_t get_minimized_symmetrical(const std::vector<bb_wrapper>& board_states);
     void get_all_minimized_flips(std::vector<bb_wrapper>& board_states);
+    int get_attribute_candidates(const uint16_t board_state[5], uint16_t candidates[MAX_ATTRIBUTE_CANDIDATES][4]);
 
     inline bb_wrapper create_wrapper(uint16_t* game_state)
     {
@@ -35,14 +40,242 @@ namespace quarto
         };
     }
 
-    class game
+    // trust me bro
+    inline constexpr uint16_t QUARTO_MAGIC_VALUES[10] = {
+        // DO NOT CHANGE (generated by compute_quarto_magic.py)
+        0x8421, 0x1248, 0x8888, 0x4444, 0x2222, 0x1111, 0xf000, 0xf00, 0xf0, 0xf
+        // to be really nerdy here optimization could be arranging these in the order of the most common quarto way so like are horizontal quato more common then positive / negative quarto?
+    };
+
+
+    inline constexpr std::array<uint8_t, 16> QUARTO_PIECES = {
+        // DO NOT CHANGE
+        0b1111,
+        0b0111,
+        0b1011,
+        0b0011,
+        0b1101, // to place
+        0b0101,
+        0b1001,
+        0b0001,
+        0b1110,
+        0b0110,
+        0b1010,
+        0b0010,
+        0b1100,
+        0b0100,
+        0b1000,
+        0b0000,
+    };
+
+    /**
+     * Inverse of QUARTO_PIECES, the piece index of every attribute nibble
+     */
+    inline constexpr std::array<uint8_t, 16> PIECE_INDICES = []
+    {
+        std::array<uint8_t, 16> piece_indices{};
+
+        for (uint8_t piece = 0; piece < 16; ++piece)
+        {
+            piece_indices[QUARTO_PIECES[piece]] = piece;
+        }
+
+        return piece_indices;
+    }();
+
+    /**
+     * Bitmask of the QUARTO_MAGIC_VALUES lines going through every square
+     */
+    inline constexpr std::array<uint16_t, 16> SQUARE_LINES = []
+    {
+        std::array<uint16_t, 16> square_lines{};
+
+        for (int square = 0; square < 16; ++square)
+        {
+            for (int line = 0; line < 10; ++line)
+            {
+                if ((QUARTO_MAGIC_VALUES[line] & (0x8000 >> square)) != 0)
+                {
+                    square_lines[square] |= 1 << line;
+                }
+            }
+        }
+
+        return square_lines;
+    }();
+
+    /**
+     * The attributes of every piece the way the line state stores them, lower nibble the attributes it has (bit i for
+     * bitboard i) and upper nibble the attributes it lacks
+     */
+    inline constexpr std::array<uint8_t, 16> PIECE_LINE_ATTRIBUTES = []
+    {
+        std::array<uint8_t, 16> piece_attributes{};
+
+        for (int piece = 0; piece < 16; ++piece)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                piece_attributes[piece] |= (QUARTO_PIECES[piece] & 0x8 >> i) != 0 ? 1 << i : 1 << (4 + i);
+            }
+        }
+
+        return piece_attributes;
+    }();
+
+    /**
+     * For every set of line attributes (see PIECE_LINE_ATTRIBUTES) the pieces having at least one of them, as a
+     * selection state bitboard (piece 0 is the highest bit)
+     */
+    inline constexpr std::array<uint16_t, 256> PIECES_WITH_ATTRIBUTES = []
+    {
+        std::array<uint16_t, 256> pieces_with_attributes{};
+
+        for (int attributes = 0; attributes < 256; ++attributes)
+        {
+            for (int piece = 0; piece < 16; ++piece)
+            {
+                if ((PIECE_LINE_ATTRIBUTES[piece] & attributes) != 0)
+                {
+                    pieces_with_attributes[attributes] |= 0x8000 >> piece;
+                }
+            }
+        }
+
+        return pieces_with_attributes;
+    }();
+
+    /**
+     * @return the one empty square of the line when three of its squares are taken, 0 otherwise. Cheaper than a
+     * popcount, which is a library call without -mpopcnt.
+     */
+    inline uint16_t last_empty_square(const uint16_t placed, const uint16_t line_mask)
+    {
+        const uint16_t empty = line_mask & ~placed;
+        return (empty & (empty - 1)) == 0 ? empty : 0;
+    }
+
+    /**
+     * Removes the square with the lowest index (square 0 is the highest bit) from the bitboard
+     * @return the index of the removed square
+     */
+    inline uint8_t pop_square(uint16_t& bitboard)
+    {
+        assert(bitboard != 0);
+
+        const auto square = static_cast<uint8_t>(std::countl_zero(bitboard));
+        bitboard &= ~(0x8000 >> square);
+
+        return square;
+    }
+
+    /**
+     * Fixed size list of packed moves, (placement << 4) | selection like compute_move returns them
+     */
+    struct move_list
+    {
+        uint8_t moves[MAX_MOVES];
+        uint8_t size = 0;
+
+        void push_back(const uint8_t placement, const uint8_t selection)
+        {
+            assert(size < MAX_MOVES);
+            moves[size++] = (placement << 4) | selection;
+        }
+
+        [[nodiscard]] const uint8_t* begin() const
+        {
+            return moves;
+        }
+
+        [[nodiscard]] const uint8_t* end() const
+        {
+            return moves + size;
+        }
+
+        [[nodiscard]] bool empty() const
+        {
+            return size == 0;
+        }
+    };
+
+    /**
+     * Plain copyable snapshot of a game, copying it is the whole cost of making a move. Next to the bitboards it keeps
+     * per line the attributes that every piece on it still shares, so finding a quarto never needs a scan of the
+     * board. How many pieces a line holds is the population of the placed bitboard masked with the line.
+     */
+    struct position
     {
         uint16_t board_state[5]{0, 0, 0, 0, 0}; // color, size, shape, fill, placed
         uint16_t selection_state = DEFAULT_GAME_SELECTION_STATE;
         uint8_t selected_piece = INVALID_PIECE_SELECTION;
-        std::stack<uint16_t> previous_board_states;
-        std::stack<uint16_t> previous_selection_states;
-        std::stack<uint8_t> previous_selected_pieces;
+        uint8_t line_shared[10]{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}; // see PIECE_LINE_ATTRIBUTES
+        bool quarto = false;
+
+        [[nodiscard]] position with_move(uint8_t square) const;
+        [[nodiscard]] position with_select(uint8_t new_selection) const;
+
+        /**
+         * Rebuilds the line state from the bitboards, needed after setting the bitboards directly
+         */
+        void recompute_lines();
+
+        /**
+         * @param piece the index of a piece (not necessarily an available one)
+         * @return bitboard of the empty squares where placing the piece makes a quarto
+         */
+        [[nodiscard]] uint16_t winning_squares(const uint8_t piece) const
+        {
+            assert(piece < 16);
+
+            const uint8_t piece_attributes = PIECE_LINE_ATTRIBUTES[piece];
+            const uint16_t placed = this->board_state[4];
+            uint16_t squares = 0;
+
+            for (int line = 0; line < 10; ++line)
+            {
+                if ((this->line_shared[line] & piece_attributes) != 0)
+                {
+                    squares |= last_empty_square(placed, QUARTO_MAGIC_VALUES[line]);
+                }
+            }
+
+            return squares;
+        }
+
+        /**
+         * @return the available pieces that complete a line somewhere on the board, handing one of them over loses
+         * on the next placement
+         */
+        [[nodiscard]] uint16_t poisoned_pieces() const
+        {
+            const uint16_t placed = this->board_state[4];
+            uint16_t pieces = 0;
+
+            for (int line = 0; line < 10; ++line)
+            {
+                if (last_empty_square(placed, QUARTO_MAGIC_VALUES[line]) != 0)
+                {
+                    pieces |= PIECES_WITH_ATTRIBUTES[this->line_shared[line]];
+                }
+            }
+
+            return pieces & this->selection_state;
+        }
+    };
+
+    static_assert(std::is_trivially_copyable_v<position>);
+
+    class game
+    {
+    public:
+        // 16 placements + 16 selections, a game can never be longer than this
+        constexpr static int MAX_UNDO_PLIES{32};
+
+    private:
+        position state;
+        position previous_states[MAX_UNDO_PLIES];
+        uint8_t previous_states_size = 0;
 
     public:
         constexpr static int BOARD_COLOR{0};
@@ -52,6 +285,7 @@ namespace quarto
         constexpr static int BOARD_PLACED{4};
 
         game() = default;
+        explicit game(const position& state);
         game(const uint16_t board_state[], uint16_t selection_state, int selected_piece);
         void do_move(uint8_t square);
         void do_select(uint8_t new_selection);
@@ -59,15 +293,37 @@ namespace quarto
         void push_state_to_undo_stack();
         void undo();
 
-        [[nodiscard]] bool is_quarto() const;
+        [[nodiscard]] bool is_quarto() const
+        {
+            return this->state.quarto;
+        }
+
+        /**
+         * @return bitboard of the empty squares where placing the given piece makes a quarto
+         */
+        [[nodiscard]] uint16_t winning_squares(const uint8_t piece) const
+        {
+            return this->state.winning_squares(piece);
+        }
+
+        /**
+         * @return the available pieces that let the opponent make a quarto with their next placement
+         */
+        [[nodiscard]] uint16_t poisoned_pieces() const
+        {
+            return this->state.poisoned_pieces();
+        }
+
         [[nodiscard]] bool is_game_over() const;
 
         void print_state() const;
 
-        [[nodiscard]] std::shared_ptr<game> clone() const
+        /**
+         * @return a copy of the current position without any undo history
+         */
+        [[nodiscard]] game clone() const
         {
-            auto new_game = game(this->board_state, this->selection_state, this->selected_piece);
-            return std::make_shared<game>(new_game);
+            return game(this->state);
         }
 
         static constexpr __uint128_t format(const uint16_t* arr)
@@ -87,26 +343,87 @@ namespace quarto
          */
         [[nodiscard]] int move_side() const
         {
-            assert(previous_board_states.size() % 2 == 0);
+            assert(previous_states_size % 2 == 0);
 
-            return ((previous_board_states.size() / 2) % 2 == 0) ? 1 : -1;
+            return ((previous_states_size / 2) % 2 == 0) ? 1 : -1;
         }
 
         [[nodiscard]] bool can_undo() const
         {
-            return !this->previous_board_states.empty();
+            return this->previous_states_size != 0;
         }
 
+        /**
+         * Minimal key of the board over all flips, attribute permutations and board symmetries. Table driven and
+         * allocation free, returns exactly the same key as canonize_reference.
+         */
         [[nodiscard]] __uint128_t canonize() const;
 
+        /**
+         * canonize together with the selected piece mapped through the same attribute flips and permutation. When
+         * several transforms reach the canonical board the smallest image of the piece is used, so symmetric
+         * positions with correspondingly transformed pieces get the same (key, selection) pair. The remaining pieces
+         * follow from the board and the selection.
+         */
+        [[nodiscard]] __uint128_t canonize_with_selection(uint8_t& selection) const;
+
+        [[nodiscard]] uint16_t get_empty_squares() const
+        {
+            return ~this->state.board_state[BOARD_PLACED];
+        }
+
+        /**
+         * @return the number of (placement, selection) moves without generating them
+         */
+        [[nodiscard]] int move_count() const
+        {
+            return std::popcount(get_empty_squares()) * std::popcount(this->state.selection_state);
+        }
+
+        /**
+         * Writes every (placement, selection) move to moves, placements in ascending order and for every placement the
+         * selections in ascending order
+         */
+        void generate_moves(move_list& moves) const;
+
+        /**
+         * generate_moves without the selections that are poisoned after the placement. Empty when every move hands
+         * over a poisoned piece, or when no pieces are left to select.
+         */
+        void generate_safe_moves(move_list& moves) const;
+
+        /**
+         * Removes every move that a symmetry leaving this position as it is (its stabilizer) maps to a move earlier in
+         * the list, moves must come from generate_moves or generate_safe_moves. Never canonizes, on a board without
+         * symmetries this is 32 transforms of the placed bitboard. It sees the attribute flips canonize does not try,
+         * but not the transpositions that are no symmetry of this position.
+         */
+        void remove_symmetric_moves(move_list& moves) const;
+
+        /**
+         * Removes every move whose resulting position has the same canonize_with_selection key as a move earlier in
+         * the list, the order of the rest stays
+         */
+        void remove_transposed_moves(move_list& moves) const;
+
+        /**
+         * The original vector based canonize, kept to verify and benchmark canonize against
+         */
+        [[nodiscard]] __uint128_t canonize_reference() const;
+
         [[nodiscard]] constexpr uint16_t get_selection_state() const
         {
-            return this->selection_state;
+            return this->state.selection_state;
         }
 
         [[nodiscard]] constexpr uint8_t get_selection_piece() const
         {
-            return this->selected_piece;
+            return this->state.selected_piece;
+        }
+
+        [[nodiscard]] constexpr const position& get_position() const
+        {
+            return this->state;
         }
 
         /**
@@ -117,39 +434,11 @@ namespace quarto
          */
         [[nodiscard]] uint8_t compute_move(int time_remaining) const;
 
-        uint16_t* get_board_state()
+        [[nodiscard]] const uint16_t* get_board_state() const
         {
-            return this->board_state;
+            return this->state.board_state;
         }
     };
-
-    // trust me bro
-    static uint16_t QUARTO_MAGIC_VALUES[10] = {
-        // DO NOT CHANGE (generated by compute_quarto_magic.py)
-        0x8421, 0x1248, 0x8888, 0x4444, 0x2222, 0x1111, 0xf000, 0xf00, 0xf0, 0xf
-        // to be really nerdy here optimization could be arranging these in the order of the most common quarto way so like are horizontal quato more common then positive / negative quarto?
-    };
-
-
-    static inline std::vector<uint8_t> QUARTO_PIECES = {
-        // DO NOT CHANGE
-        0b1111,
-        0b0111,
-        0b1011,
-        0b0011,
-        0b1101, // to place
-        0b0101,
-        0b1001,
-        0b0001,
-        0b1110,
-        0b0110,
-        0b1010,
-        0b0010,
-        0b1100,
-        0b0100,
-        0b1000,
-        0b0000,
-    };
 } // quarto
 
 #endif //SHMINIMAXING_GAME_H
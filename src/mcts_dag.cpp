@@ -0,0 +1,114 @@
+#include "mcts_dag.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <thread>
+
+namespace
+{
+    constexpr uint64_t OCCUPIED{1ull << 24};
+
+    // splitmix64 finalizer
+    uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111eb;
+        x ^= x >> 31;
+        return x;
+    }
+}
+
+namespace quarto
+{
+    mcts_dag::mcts_dag(const size_t size_mb)
+    {
+        // a quarter for the positions, every expanded one has about a dozen edges or more
+        const size_t bytes = size_mb * 1024 * 1024;
+        position_mask = std::bit_floor(std::max<size_t>(bytes / 4 / sizeof(dag_position), 2)) - 1;
+        positions = std::make_unique<dag_position[]>(position_mask + 1);
+
+        // the last index would be NO_NODE
+        edge_capacity = static_cast<uint32_t>(std::min<size_t>(bytes / 4 * 3 / sizeof(dag_edge), search_node::NO_NODE));
+        edges = std::make_unique<dag_edge[]>(edge_capacity);
+    }
+
+    uint32_t mcts_dag::find_or_insert(const position& state)
+    {
+        uint8_t selection;
+        const auto key = game(state).canonize_with_selection(selection);
+        const uint64_t upper = static_cast<uint16_t>(key >> 64) | static_cast<uint64_t>(selection) << 16 | OCCUPIED;
+        const auto lower = static_cast<uint64_t>(key);
+
+        auto index = mix(lower ^ mix(upper)) & position_mask;
+        for (size_t probe = 0; probe <= position_mask; ++probe, index = (index + 1) & position_mask)
+        {
+            auto& slot = positions[index];
+            auto current = slot.upper.load(std::memory_order_relaxed);
+
+            if (current == 0)
+            {
+                // a nearly full table takes long to probe, the position stays out of it
+                if (position_count.load(std::memory_order_relaxed) >= (position_mask + 1) / 4 * 3)
+                {
+                    return search_node::NO_NODE;
+                }
+
+                if (slot.upper.compare_exchange_strong(current, upper, std::memory_order_relaxed))
+                {
+                    slot.lower.store(lower, std::memory_order_relaxed);
+                    slot.state = state;
+                    slot.ready.store(true, std::memory_order_release);
+                    position_count.fetch_add(1, std::memory_order_relaxed);
+                    return static_cast<uint32_t>(index);
+                }
+                // another thread took the slot, current is its key now
+            }
+
+            if (current != upper)
+            {
+                continue;
+            }
+
+            // the thread that took the slot is about to write the rest of it
+            while (!slot.ready.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            if (slot.lower.load(std::memory_order_relaxed) == lower)
+            {
+                return static_cast<uint32_t>(index);
+            }
+        }
+
+        return search_node::NO_NODE;
+    }
+
+    uint32_t mcts_dag::allocate_edges(const uint32_t count)
+    {
+        auto current = next_edge.load(std::memory_order_relaxed);
+        do
+        {
+            if (current + static_cast<uint64_t>(count) > edge_capacity)
+            {
+                return search_node::NO_NODE;
+            }
+        }
+        while (!next_edge.compare_exchange_weak(current, current + count, std::memory_order_relaxed));
+
+        return current;
+    }
+
+    size_t mcts_dag::get_size() const
+    {
+        return position_count.load(std::memory_order_relaxed);
+    }
+
+    size_t mcts_dag::get_capacity() const
+    {
+        return position_mask + 1;
+    }
+} // quarto
@@ -0,0 +1,192 @@
+#ifndef SHMINIMAXING_MCTS_DAG_H
+#define SHMINIMAXING_MCTS_DAG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "game.h"
+#include "node_arena.h"
+
+#define DEFAULT_MCTS_DAG_MB 128
+
+namespace quarto
+{
+    /**
+     * Move from one position of an mcts_dag to the next. The edge counts the visits that went through it, the score
+     * is the one of the position it leads to, which it shares with every other edge leading there.
+     */
+    struct dag_edge
+    {
+        std::atomic<int32_t> n{0};
+        // the position the move leads to, looked up the first time a playout goes through the edge
+        std::atomic<uint32_t> child{search_node::NO_NODE};
+        // (placement << 4) | selection in the orientation of the position the edge leaves
+        uint8_t move = 0;
+    };
+
+    static_assert(sizeof(dag_edge) <= 12);
+
+    /**
+     * Position of an mcts_dag, one per canonical key. Its edges are the moves of the position it was first reached as,
+     * playouts that get here from another orientation continue from that one.
+     */
+    struct dag_position
+    {
+        // upper 16 bits of the canonized board, the selection and OCCUPIED, 0 while the slot is empty
+        std::atomic<uint64_t> upper{0};
+        // lower 64 bits of the canonized board, valid once ready
+        std::atomic<uint64_t> lower{0};
+        std::atomic<int32_t> t{0};
+        std::atomic<int32_t> n{0};
+        // edge_count edges starting at first_edge, written before expansion becomes EXPANDED
+        uint32_t first_edge = search_node::NO_NODE;
+        uint8_t edge_count = 0;
+        std::atomic<uint8_t> visited_edges{0};
+        std::atomic<uint8_t> expansion{search_node::UNEXPANDED};
+        // set once the key and the position below are written
+        std::atomic<bool> ready{false};
+        position state;
+
+        bool begin_expansion()
+        {
+            uint8_t expected = search_node::UNEXPANDED;
+            return expansion.compare_exchange_strong(expected, search_node::EXPANDING, std::memory_order_relaxed);
+        }
+
+        void finish_expansion(const uint32_t first, const uint8_t count)
+        {
+            first_edge = first;
+            edge_count = count;
+            expansion.store(search_node::EXPANDED, std::memory_order_release);
+        }
+
+        [[nodiscard]] bool is_expanded() const
+        {
+            return expansion.load(std::memory_order_acquire) == search_node::EXPANDED;
+        }
+
+        /**
+         * @return the next edge without a playout, NO_NODE if all of them had one. The position has to be expanded.
+         */
+        uint32_t take_unvisited_edge()
+        {
+            auto visited = visited_edges.load(std::memory_order_relaxed);
+            while (visited < edge_count)
+            {
+                if (visited_edges.compare_exchange_weak(visited, visited + 1, std::memory_order_relaxed))
+                {
+                    return first_edge + visited;
+                }
+            }
+
+            return search_node::NO_NODE;
+        }
+
+        /**
+         * search_node::add_virtual_loss, every edge into a position is picked by the same side since they all place
+         * the same number of pieces
+         *
+         * @return the visits before this one
+         */
+        int add_virtual_loss(const int loss, const int side)
+        {
+            t.fetch_sub(side * loss, std::memory_order_relaxed);
+            return n.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /**
+         * search_node::add_result
+         */
+        void add_result(const int score, const int playouts, const int loss, const int side)
+        {
+            t.fetch_add(score + side * loss, std::memory_order_relaxed);
+            if (playouts > 1)
+            {
+                n.fetch_add(playouts - 1, std::memory_order_relaxed);
+            }
+        }
+
+        [[nodiscard]] int n_visits() const
+        {
+            return n.load(std::memory_order_relaxed);
+        }
+    };
+
+    static_assert(sizeof(dag_position) <= 64);
+
+    /**
+     * The positions and edges one playout went through, the root first
+     */
+    struct dag_path
+    {
+        uint32_t positions[game::MAX_UNDO_PLIES / 2 + 1];
+        uint32_t edges[game::MAX_UNDO_PLIES / 2];
+        // edges taken, positions[length] is the leaf
+        int length = 0;
+    };
+
+    /**
+     * Transposition aware monte carlo tree for one search: positions live in a fixed size open addressing hash table
+     * keyed by game::canonize_with_selection, so every position reached by another move order or as a symmetry is
+     * one node with one set of statistics. Positions and edges are only ever added, lookups and inserts never lock.
+     */
+    class mcts_dag
+    {
+    public:
+        explicit mcts_dag(size_t size_mb = DEFAULT_MCTS_DAG_MB);
+
+        mcts_dag(const mcts_dag&) = delete;
+        mcts_dag& operator=(const mcts_dag&) = delete;
+
+        /**
+         * Finds the position with the canonical key of state, adds it with state as its orientation if there is none
+         *
+         * @return the index of the position, search_node::NO_NODE if the table is full
+         */
+        uint32_t find_or_insert(const position& state);
+
+        /**
+         * @return the index of the first of count consecutive new edges, search_node::NO_NODE if there is no room
+         */
+        uint32_t allocate_edges(uint32_t count);
+
+        dag_position& operator[](const uint32_t index)
+        {
+            return positions[index];
+        }
+
+        const dag_position& operator[](const uint32_t index) const
+        {
+            return positions[index];
+        }
+
+        dag_edge& edge(const uint32_t index)
+        {
+            return edges[index];
+        }
+
+        [[nodiscard]] const dag_edge& edge(const uint32_t index) const
+        {
+            return edges[index];
+        }
+
+        /**
+         * @return the number of positions in the table
+         */
+        [[nodiscard]] size_t get_size() const;
+        [[nodiscard]] size_t get_capacity() const;
+
+    private:
+        std::unique_ptr<dag_position[]> positions;
+        size_t position_mask;
+        std::atomic<size_t> position_count{0};
+
+        std::unique_ptr<dag_edge[]> edges;
+        uint32_t edge_capacity;
+        std::atomic<uint32_t> next_edge{0};
+    };
+} // quarto
+
+#endif //SHMINIMAXING_MCTS_DAG_H
@@ -0,0 +1,250 @@
+#include "mcts_session.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "search.h"
+#include "symmetries.h"
+
+namespace quarto
+{
+    bool same_position(const position& a, const position& b)
+    {
+        for (int i = 0; i < 5; ++i)
+        {
+            if (a.board_state[i] != b.board_state[i])
+            {
+                return false;
+            }
+        }
+
+        return a.selection_state == b.selection_state && a.selected_piece == b.selected_piece;
+    }
+
+    /**
+     * @return the board symmetry that turns from into to with the same pieces, -1 if there is none. canonize doesn't
+     * always give such positions the same key.
+     */
+    int board_symmetry(const position& from, const position& to)
+    {
+        if (from.selection_state != to.selection_state || from.selected_piece != to.selected_piece)
+        {
+            return -1;
+        }
+
+        for (int symmetry = 0; symmetry < symmetries::board::SYMMETRY_COUNT; ++symmetry)
+        {
+            bool same = true;
+            for (int i = 0; i < 5 && same; ++i)
+            {
+                same = symmetries::board::transform(symmetry, from.board_state[i]) == to.board_state[i];
+            }
+
+            if (same)
+            {
+                return symmetry;
+            }
+        }
+
+        return -1;
+    }
+
+    position with_packed_move(const position& state, const uint8_t move)
+    {
+        return state.with_move(move >> 4).with_select(move & 0xf);
+    }
+
+    mcts_session& mcts_session::get_instance()
+    {
+        static mcts_session session;
+        return session;
+    }
+
+    mcts_session::mcts_session(const size_t arena_mb) : arena_mb(arena_mb)
+    {
+    }
+
+    uint32_t mcts_session::find(const game& game_state, game& tree_state) const
+    {
+        if (arena == nullptr)
+        {
+            return search_node::NO_NODE;
+        }
+
+        // the root itself if the same position is searched again, then every reply to the move played
+        std::vector<std::pair<uint32_t, position>> candidates{{root, root_state.get_position()}};
+        if (played != search_node::NO_NODE && (*arena)[played].is_expanded())
+        {
+            const auto& node = (*arena)[played];
+            const auto after_move = with_packed_move(root_state.get_position(), node.move);
+            for (uint32_t i = 0; i < node.child_count; ++i)
+            {
+                const auto reply = (*arena)[node.first_child + i].move;
+                candidates.emplace_back(node.first_child + i, with_packed_move(after_move, reply));
+            }
+        }
+
+        for (const auto& [node, state] : candidates)
+        {
+            if (same_position(state, game_state.get_position()))
+            {
+                tree_state = game(state);
+                return node;
+            }
+        }
+
+        // the reply the opponent played can be a symmetry of one in the tree, remove_symmetric_moves only kept one
+        for (const auto& [node, state] : candidates)
+        {
+            if (board_symmetry(state, game_state.get_position()) >= 0)
+            {
+                tree_state = game(state);
+                return node;
+            }
+        }
+
+        // one with the attributes flipped or swapped as well only has the same canonical key
+        uint8_t selection;
+        const auto key = game_state.canonize_with_selection(selection);
+        for (const auto& [node, state] : candidates)
+        {
+            uint8_t candidate_selection;
+            if (game(state).canonize_with_selection(candidate_selection) == key && candidate_selection == selection)
+            {
+                tree_state = game(state);
+                return node;
+            }
+        }
+
+        return search_node::NO_NODE;
+    }
+
+    /**
+     * For every child of node, the move of game_state that leads to the same position up to symmetry as the child does
+     * from tree_state
+     *
+     * @return false if some child has no such move, canonize doesn't try every attribute flip
+     */
+    bool map_children(const node_arena& arena, const search_node& node, const game& tree_state, const game& game_state,
+                      std::vector<uint8_t>& mapped)
+    {
+        // a symmetry of the board alone maps every move exactly, the placement goes to its image
+        mapped.clear();
+        if (const auto symmetry = board_symmetry(tree_state.get_position(), game_state.get_position()); symmetry >= 0)
+        {
+            for (uint32_t i = 0; i < node.child_count; ++i)
+            {
+                const auto move = arena[node.first_child + i].move;
+                const auto image = std::countl_zero(symmetries::board::transform(symmetry, 0x8000 >> (move >> 4)));
+                mapped.push_back(static_cast<uint8_t>(image << 4 | (move & 0xf)));
+            }
+            return true;
+        }
+
+        // otherwise the attributes are flipped or swapped as well, which the canonical keys see
+        move_list moves;
+        game_state.generate_moves(moves);
+
+        std::vector<std::pair<__uint128_t, uint8_t>> keys;
+        for (const auto move : moves)
+        {
+            uint8_t selection;
+            const auto key = game(with_packed_move(game_state.get_position(), move)).canonize_with_selection(selection);
+            keys.emplace_back(key, selection);
+        }
+
+        mapped.clear();
+        for (uint32_t i = 0; i < node.child_count; ++i)
+        {
+            const auto move = arena[node.first_child + i].move;
+            uint8_t selection;
+            const auto key = game(with_packed_move(tree_state.get_position(), move)).canonize_with_selection(selection);
+
+            const auto same = std::find(keys.begin(), keys.end(), std::make_pair(key, selection));
+            if (same == keys.end())
+            {
+                return false;
+            }
+            mapped.push_back(moves.moves[same - keys.begin()]);
+        }
+
+        return true;
+    }
+
+    uint8_t mcts_session::search(const game& game_state, const int search_time)
+    {
+        std::lock_guard lock(session_mtx);
+
+        game tree_state;
+        auto found = find(game_state, tree_state);
+        if (found != search_node::NO_NODE && found != root)
+        {
+            // the rest of the tree goes away with the old arena
+            auto promoted = std::make_unique<node_arena>(arena_mb);
+            root = promoted->copy_subtree(*arena, found);
+            arena = std::move(promoted);
+            root_state = tree_state;
+            if (!(*arena)[root].is_expanded())
+            {
+                search::populate_children(*arena, root, root_state);
+            }
+        }
+
+        // the moves of the children of root on game_state, if the tree is a symmetry of it
+        const bool symmetric = found != search_node::NO_NODE &&
+            !same_position(root_state.get_position(), game_state.get_position());
+        std::vector<uint8_t> mapped;
+        if (found == search_node::NO_NODE ||
+            (symmetric && !map_children(*arena, (*arena)[root], root_state, game_state, mapped)))
+        {
+            arena = std::make_unique<node_arena>(arena_mb);
+            root = arena->allocate(1);
+            root_state = game_state.clone();
+            search::populate_children(*arena, root, root_state);
+            found = search_node::NO_NODE;
+        }
+
+        reused_visits = found == search_node::NO_NODE ? 0 : (*arena)[root].n_visits();
+        std::cout << "reused visits: " << reused_visits << std::endl;
+
+        auto game_copy = root_state.clone();
+        const auto move = search::search_mnt(*arena, root, game_copy, search_time);
+
+        const auto& node = (*arena)[root];
+        played = search_node::NO_NODE;
+        for (uint32_t i = 0; i < node.child_count; ++i)
+        {
+            if ((*arena)[node.first_child + i].move == move)
+            {
+                played = node.first_child + i;
+            }
+        }
+
+        if (found == search_node::NO_NODE || !symmetric)
+        {
+            return move;
+        }
+
+        assert(played != search_node::NO_NODE);
+        return mapped[played - node.first_child];
+    }
+
+    void mcts_session::clear()
+    {
+        std::lock_guard lock(session_mtx);
+
+        arena.reset();
+        root = search_node::NO_NODE;
+        played = search_node::NO_NODE;
+        reused_visits = 0;
+    }
+
+    int mcts_session::get_reused_visits() const
+    {
+        return reused_visits;
+    }
+} // quarto
@@ -0,0 +1,70 @@
+#ifndef SHMINIMAXING_MCTS_SESSION_H
+#define SHMINIMAXING_MCTS_SESSION_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "game.h"
+#include "node_arena.h"
+
+namespace quarto
+{
+    /**
+     * Keeps the monte carlo tree from one move of a game to the next. A search first looks for the position it is
+     * given two moves below the root of the last one, below the move that search played: by playing the replies there
+     * and comparing the positions, and if none is the same by comparing canonical keys. The node it finds becomes the
+     * root of a fresh arena with everything below it, the rest of the tree is freed.
+     *
+     * Node scores are for the player to move at the root, so the tree is only reused for the same player.
+     */
+    class mcts_session
+    {
+    public:
+        /**
+         * The session the engine uses
+         */
+        static mcts_session& get_instance();
+
+        explicit mcts_session(size_t arena_mb = DEFAULT_NODE_ARENA_MB);
+
+        mcts_session(const mcts_session&) = delete;
+        mcts_session& operator=(const mcts_session&) = delete;
+
+        /**
+         * search::search_mnt from the tree of the last search if it reached this position, otherwise from a new one
+         *
+         * @return the move to play on game_state
+         */
+        uint8_t search(const game& game_state, int search_time);
+
+        /**
+         * Frees the tree, the next search starts a new one
+         */
+        void clear();
+
+        /**
+         * @return the visits the root already had when the last search started, 0 if it started a new tree
+         */
+        [[nodiscard]] int get_reused_visits() const;
+
+    private:
+        size_t arena_mb;
+        std::unique_ptr<node_arena> arena;
+        uint32_t root = search_node::NO_NODE;
+        // the position of root, which is a symmetry of the position searched if the tree was found by canonical key
+        game root_state;
+        // the child of root the last search played
+        uint32_t played = search_node::NO_NODE;
+        int reused_visits = 0;
+        std::mutex session_mtx;
+
+        /**
+         * @return the node of the tree at the position of game_state or a symmetry of it, which tree_state is set to,
+         * search_node::NO_NODE if there is none
+         */
+        uint32_t find(const game& game_state, game& tree_state) const;
+    };
+} // quarto
+
+#endif //SHMINIMAXING_MCTS_SESSION_H
@@ -0,0 +1,141 @@
+#include "node_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+#include <vector>
+
+namespace quarto
+{
+    node_arena::node_arena(const size_t size_mb)
+    {
+        // the last index of the last chunk would be NO_NODE
+        constexpr size_t max_chunks = (1ull << (32 - CHUNK_BITS)) - 1;
+        chunk_count = std::clamp<size_t>(size_mb * 1024 * 1024 / (sizeof(search_node) * CHUNK_SIZE), 1, max_chunks);
+        chunks = std::make_unique<std::atomic<search_node*>[]>(chunk_count);
+    }
+
+    node_arena::~node_arena()
+    {
+        for (size_t i = 0; i < chunk_count; ++i)
+        {
+            delete[] chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    uint32_t node_arena::allocate(const uint32_t count)
+    {
+        assert(count > 0 && count <= CHUNK_SIZE);
+
+        auto current = next.load(std::memory_order_relaxed);
+        uint32_t block;
+        do
+        {
+            block = current;
+            if ((block & (CHUNK_SIZE - 1)) + count > CHUNK_SIZE)
+            {
+                // start the block in the next chunk, the end of this one stays unused
+                block = ((block >> CHUNK_BITS) + 1) << CHUNK_BITS;
+            }
+
+            if ((block >> CHUNK_BITS) >= chunk_count)
+            {
+                return search_node::NO_NODE;
+            }
+        }
+        while (!next.compare_exchange_weak(current, block + count, std::memory_order_relaxed));
+
+        // the thread that publishes the block index (with finish_expansion) made the chunk first, so whoever reads
+        // the index sees the chunk too
+        if (chunks[block >> CHUNK_BITS].load(std::memory_order_acquire) == nullptr)
+        {
+            make_chunk(block >> CHUNK_BITS);
+        }
+
+        return block;
+    }
+
+    /**
+     * Copies everything of from but the links to other nodes
+     */
+    void copy_node(const search_node& from, search_node& to)
+    {
+        to.t.store(from.t.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.n.store(from.n.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.visited_children.store(from.visited_children.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.proof.store(from.proof.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        to.move = from.move;
+
+        // an unsolved leaf without children may only have been one because the arena was full
+        const bool leaf = from.is_expanded() && from.child_count == 0 && !from.is_proven();
+        to.state.store(leaf ? search_node::UNEXPANDED : from.state.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+    }
+
+    uint32_t node_arena::copy_subtree(const node_arena& source, const uint32_t node)
+    {
+        const auto root = allocate(1);
+        if (root == search_node::NO_NODE)
+        {
+            return root;
+        }
+        copy_node(source[node], (*this)[root]);
+
+        // (node in source, its copy) of the nodes whose children are still to be copied
+        std::vector<std::pair<uint32_t, uint32_t>> pending;
+        if ((*this)[root].is_expanded())
+        {
+            pending.emplace_back(node, root);
+        }
+
+        while (!pending.empty())
+        {
+            const auto [from, to] = pending.back();
+            pending.pop_back();
+
+            const auto& parent = source[from];
+            const auto first_child = allocate(parent.child_count);
+            if (first_child == search_node::NO_NODE)
+            {
+                (*this)[to].visited_children.store(0, std::memory_order_relaxed);
+                (*this)[to].state.store(search_node::UNEXPANDED, std::memory_order_relaxed);
+                continue;
+            }
+
+            for (uint32_t i = 0; i < parent.child_count; ++i)
+            {
+                auto& child = (*this)[first_child + i];
+                copy_node(source[parent.first_child + i], child);
+                child.parent = to;
+
+                if (child.is_expanded() && source[parent.first_child + i].child_count != 0)
+                {
+                    pending.emplace_back(parent.first_child + i, first_child + i);
+                }
+            }
+
+            (*this)[to].finish_expansion(first_child, parent.child_count);
+        }
+
+        return root;
+    }
+
+    void node_arena::make_chunk(const size_t chunk)
+    {
+        std::lock_guard lock(chunk_mtx);
+        if (chunks[chunk].load(std::memory_order_relaxed) == nullptr)
+        {
+            chunks[chunk].store(new search_node[CHUNK_SIZE], std::memory_order_release);
+        }
+    }
+
+    size_t node_arena::get_size() const
+    {
+        return std::min<size_t>(next.load(std::memory_order_relaxed), chunk_count * CHUNK_SIZE);
+    }
+
+    size_t node_arena::get_capacity() const
+    {
+        return chunk_count * CHUNK_SIZE;
+    }
+} // quarto
@@ -0,0 +1,215 @@
+#ifndef SHMINIMAXING_NODE_ARENA_H
+#define SHMINIMAXING_NODE_ARENA_H
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#define DEFAULT_NODE_ARENA_MB 256
+
+namespace quarto
+{
+    /**
+     * Monte carlo tree node. Nodes refer to each other by their index in a node_arena, the children of a node are
+     * child_count consecutive nodes starting at first_child.
+     */
+    struct search_node
+    {
+        constexpr static uint32_t NO_NODE{0xffffffff};
+
+        // the thread that moves a node from UNEXPANDED to EXPANDING generates its children, the others play out from
+        // the node meanwhile. An expanded node without children is terminal.
+        constexpr static uint8_t UNEXPANDED{0};
+        constexpr static uint8_t EXPANDING{1};
+        constexpr static uint8_t EXPANDED{2};
+
+        // solved nodes, the result is for the player to move at the node
+        constexpr static uint8_t UNPROVEN{0};
+        constexpr static uint8_t PROVEN_WIN{1};
+        constexpr static uint8_t PROVEN_LOSS{2};
+
+        std::atomic<int32_t> t{0};
+        std::atomic<int32_t> n{0};
+        uint32_t parent = NO_NODE;
+        // first_child and child_count are written before the state becomes EXPANDED and never change after
+        uint32_t first_child = NO_NODE;
+        uint8_t child_count = 0;
+        // children are handed out for their first playout in order, the first visited_children of them had theirs
+        std::atomic<uint8_t> visited_children{0};
+        std::atomic<uint8_t> state{UNEXPANDED};
+        // only ever goes from UNPROVEN to one of the proven results
+        std::atomic<uint8_t> proof{UNPROVEN};
+        // (placement << 4) | selection of the move that leads here
+        uint8_t move = 0;
+
+        /**
+         * @return true if the calling thread gets to expand the node
+         */
+        bool begin_expansion()
+        {
+            uint8_t expected = UNEXPANDED;
+            return state.compare_exchange_strong(expected, EXPANDING, std::memory_order_relaxed);
+        }
+
+        /**
+         * Publishes the children, they have to be filled in before
+         */
+        void finish_expansion(const uint32_t first, const uint8_t count)
+        {
+            first_child = first;
+            child_count = count;
+            state.store(EXPANDED, std::memory_order_release);
+        }
+
+        [[nodiscard]] bool is_expanded() const
+        {
+            return state.load(std::memory_order_acquire) == EXPANDED;
+        }
+
+        [[nodiscard]] uint8_t get_proof() const
+        {
+            return proof.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] bool is_proven() const
+        {
+            return get_proof() != UNPROVEN;
+        }
+
+        void set_proof(const uint8_t result)
+        {
+            proof.store(result, std::memory_order_relaxed);
+        }
+
+        /**
+         * @return the next child without a playout, NO_NODE if all of them had one. The node has to be expanded.
+         */
+        uint32_t take_unvisited_child()
+        {
+            auto visited = visited_children.load(std::memory_order_relaxed);
+            while (visited < child_count)
+            {
+                if (visited_children.compare_exchange_weak(visited, visited + 1, std::memory_order_relaxed))
+                {
+                    return first_child + visited;
+                }
+            }
+
+            return NO_NODE;
+        }
+
+        [[nodiscard]] double get_t_score() const
+        {
+            return t.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Counts the playout that is on its way through the node as a loss until its result comes back, so the
+         * other threads pick different paths meanwhile
+         *
+         * @param side game::move_side of the player picking the node, the loss is one for them
+         */
+        void add_virtual_loss(const int loss, const int side)
+        {
+            n.fetch_add(1, std::memory_order_relaxed);
+            t.fetch_sub(side * loss, std::memory_order_relaxed);
+        }
+
+        /**
+         * Replaces the virtual loss by the summed score of playouts games, the first of which is counted already
+         *
+         * @param side the same as for add_virtual_loss
+         */
+        void add_result(const int score, const int playouts, const int loss, const int side)
+        {
+            t.fetch_add(score + side * loss, std::memory_order_relaxed);
+            if (playouts > 1)
+            {
+                n.fetch_add(playouts - 1, std::memory_order_relaxed);
+            }
+        }
+
+        [[nodiscard]] int n_visits() const
+        {
+            return n.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @param exploration c * sqrt(log(parent visits)), the same for all children of a node
+         * @param side 1 if the root player picks among the children, -1 if the opponent does
+         */
+        [[nodiscard]] double get_uct(const double exploration, const int side) const
+        {
+            const auto visits = n.load(std::memory_order_relaxed);
+            if (visits == 0)
+            {
+                return INFINITY;
+            }
+
+            return (side * t.load(std::memory_order_relaxed) + exploration * sqrt(visits)) / static_cast<double>(visits);
+        }
+    };
+
+    static_assert(sizeof(search_node) <= 24);
+
+    /**
+     * Grow only store of search_nodes for one tree, everything is freed at once when the arena goes away. Nodes are
+     * allocated in chunks of CHUNK_SIZE on first use, a block of children never crosses a chunk so it stays
+     * contiguous. Allocating is lock free apart from the first allocation in a chunk.
+     */
+    class node_arena
+    {
+    public:
+        constexpr static uint32_t CHUNK_BITS{16};
+        constexpr static uint32_t CHUNK_SIZE{1u << CHUNK_BITS};
+
+        explicit node_arena(size_t size_mb = DEFAULT_NODE_ARENA_MB);
+        ~node_arena();
+
+        node_arena(const node_arena&) = delete;
+        node_arena& operator=(const node_arena&) = delete;
+
+        /**
+         * @return the index of the first of count consecutive new nodes, search_node::NO_NODE if the arena is full
+         */
+        uint32_t allocate(uint32_t count);
+
+        /**
+         * Copies node of source and everything below it into this arena, with the copy of node as a root. Nodes left
+         * as leaves because source was full become unexpanded again, so they get their children the next time. Neither
+         * arena can be searched meanwhile.
+         *
+         * @return the index of the copy of node, search_node::NO_NODE if this arena is full
+         */
+        uint32_t copy_subtree(const node_arena& source, uint32_t node);
+
+        search_node& operator[](const uint32_t index)
+        {
+            return chunks[index >> CHUNK_BITS].load(std::memory_order_relaxed)[index & (CHUNK_SIZE - 1)];
+        }
+
+        const search_node& operator[](const uint32_t index) const
+        {
+            return chunks[index >> CHUNK_BITS].load(std::memory_order_relaxed)[index & (CHUNK_SIZE - 1)];
+        }
+
+        /**
+         * @return the number of allocated nodes, including the ones skipped at the end of a chunk
+         */
+        [[nodiscard]] size_t get_size() const;
+        [[nodiscard]] size_t get_capacity() const;
+
+    private:
+        std::unique_ptr<std::atomic<search_node*>[]> chunks;
+        size_t chunk_count;
+        std::atomic<uint32_t> next{0};
+        std::mutex chunk_mtx;
+
+        void make_chunk(size_t chunk);
+    };
+} // quarto
+
+#endif //SHMINIMAXING_NODE_ARENA_H
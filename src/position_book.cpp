@@ -0,0 +1,256 @@
+#include "position_book.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr unsigned char BOOK_MAGIC[4]{'S', 'H', 'M', 'B'};
+
+    uint64_t read_big_endian(const unsigned char* bytes, const int size)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < size; ++i)
+        {
+            value = value << 8 | bytes[i];
+        }
+        return value;
+    }
+
+    void write_big_endian(unsigned char* bytes, const uint64_t value, const int size)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            bytes[i] = static_cast<unsigned char>(value >> (8 * (size - 1 - i)));
+        }
+    }
+
+    void encode_key(const __uint128_t state, const uint8_t selection, unsigned char key[position_book::KEY_SIZE])
+    {
+        write_big_endian(key, static_cast<uint16_t>(state >> 64), 2);
+        write_big_endian(key + 2, static_cast<uint64_t>(state), 8);
+        key[10] = selection;
+    }
+}
+
+position_book::~position_book()
+{
+    close();
+}
+
+bool position_book::open(const std::string& filename)
+{
+    close();
+
+#ifdef _WIN32
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    buffer.assign(std::istreambuf_iterator<char>(file), {});
+    data = buffer.data();
+    mapped_size = buffer.size();
+#else
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    struct stat file_stat{};
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(HEADER_SIZE))
+    {
+        ::close(fd);
+        std::cerr << "book " << filename << " is too small" << std::endl;
+        return false;
+    }
+
+    mapped_size = static_cast<size_t>(file_stat.st_size);
+    void* mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // the mapping keeps the file alive
+
+    if (mapped == MAP_FAILED)
+    {
+        mapped_size = 0;
+        std::cerr << "error mapping book " << filename << std::endl;
+        return false;
+    }
+
+    // probes jump around the whole file, read ahead would only pull in pages that are never used
+    madvise(mapped, mapped_size, MADV_RANDOM);
+    data = static_cast<const unsigned char*>(mapped);
+#endif
+
+    if (mapped_size < HEADER_SIZE || std::memcmp(data, BOOK_MAGIC, sizeof(BOOK_MAGIC)) != 0
+        || read_big_endian(data + 4, 4) != VERSION)
+    {
+        std::cerr << "book " << filename << " has the wrong magic or version" << std::endl;
+        close();
+        return false;
+    }
+
+    record_count = read_big_endian(data + 8, 8);
+
+    if (HEADER_SIZE + record_count * RECORD_SIZE != mapped_size)
+    {
+        std::cerr << "book " << filename << " is truncated" << std::endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void position_book::close()
+{
+#ifdef _WIN32
+    buffer.clear();
+    buffer.shrink_to_fit();
+#else
+    if (data != nullptr)
+    {
+        munmap(const_cast<unsigned char*>(data), mapped_size);
+    }
+#endif
+
+    data = nullptr;
+    mapped_size = 0;
+    record_count = 0;
+}
+
+bool position_book::probe(const __uint128_t state, const uint8_t selection, int& value) const
+{
+    if (record_count == 0)
+    {
+        return false;
+    }
+
+    unsigned char key[KEY_SIZE];
+    encode_key(state, selection, key);
+
+    const unsigned char* records = data + HEADER_SIZE;
+    size_t low = 0;
+    size_t high = record_count;
+
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        const int order = std::memcmp(records + middle * RECORD_SIZE, key, KEY_SIZE);
+
+        if (order == 0)
+        {
+            value = static_cast<int8_t>(records[middle * RECORD_SIZE + KEY_SIZE]);
+            return true;
+        }
+
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return false;
+}
+
+size_t position_book::get_size() const
+{
+    return record_count;
+}
+
+bool position_book::is_open() const
+{
+    return data != nullptr;
+}
+
+position_book::record position_book::get_record(const size_t index) const
+{
+    assert(index < record_count);
+
+    return decode_record(data + HEADER_SIZE + index * RECORD_SIZE);
+}
+
+void position_book::encode_record(const record& r, unsigned char bytes[RECORD_SIZE])
+{
+    encode_key(r.state, r.selection, bytes);
+    bytes[KEY_SIZE] = static_cast<unsigned char>(r.value);
+}
+
+position_book::record position_book::decode_record(const unsigned char bytes[RECORD_SIZE])
+{
+    return record{
+        static_cast<__uint128_t>(read_big_endian(bytes, 2)) << 64 | read_big_endian(bytes + 2, 8),
+        bytes[10],
+        static_cast<int8_t>(bytes[KEY_SIZE]),
+    };
+}
+
+bool position_book::write(const std::string& filename, std::vector<record> records)
+{
+    std::stable_sort(records.begin(), records.end(), [](const record& a, const record& b)
+    {
+        return a.state != b.state ? a.state < b.state : a.selection < b.selection;
+    });
+
+    // keep the last record of every key
+    std::vector<unsigned char> bytes(HEADER_SIZE);
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        if (i + 1 < records.size() && records[i + 1].state == records[i].state
+            && records[i + 1].selection == records[i].selection)
+        {
+            continue;
+        }
+
+        unsigned char record_bytes[RECORD_SIZE];
+        encode_record(records[i], record_bytes);
+        bytes.insert(bytes.end(), std::begin(record_bytes), std::end(record_bytes));
+    }
+
+    std::memcpy(bytes.data(), BOOK_MAGIC, sizeof(BOOK_MAGIC));
+    write_big_endian(bytes.data() + 4, VERSION, 4);
+    write_big_endian(bytes.data() + 8, (bytes.size() - HEADER_SIZE) / RECORD_SIZE, 8);
+
+    const std::string temporary = filename + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cerr << "error opening file " << temporary << std::endl;
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!file)
+        {
+            std::cerr << "error writing file " << temporary << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, filename, error);
+    if (error)
+    {
+        std::cerr << "error renaming " << temporary << " to " << filename << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    return true;
+}
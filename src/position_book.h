@@ -0,0 +1,85 @@
+#ifndef SHMINIMAXING_POSITION_BOOK_H
+#define SHMINIMAXING_POSITION_BOOK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define BOOK_FILE_EXTENSION ".shmb"
+
+/**
+ * Read only book of solved positions, memory mapped and probed in place so opening it costs nothing no matter its size
+ * and every process on the host shares the same pages.
+ *
+ * The file is a 16 byte header (the magic, the version and the record count, big endian) followed by fixed 12 byte
+ * records sorted by key: the canonized board in 10 big endian bytes, the selection and the eval. Big endian keys sort
+ * the same way as their bytes, so the binary search compares records with memcmp.
+ */
+class position_book
+{
+public:
+    constexpr static size_t HEADER_SIZE{16};
+    constexpr static size_t RECORD_SIZE{12};
+    constexpr static size_t KEY_SIZE{11};
+    constexpr static uint32_t VERSION{1};
+
+    struct record
+    {
+        __uint128_t state;
+        uint8_t selection;
+        int8_t value;
+    };
+
+    position_book() = default;
+    ~position_book();
+
+    position_book(const position_book&) = delete;
+    position_book& operator=(const position_book&) = delete;
+
+    /**
+     * Maps the book, a book that was open before is closed first
+     *
+     * @return false if the file does not exist or is not a valid book
+     */
+    bool open(const std::string& filename);
+    void close();
+
+    /**
+     * @return true and writes the eval if the (state, selection) pair is in the book, safe to call from any thread
+     */
+    bool probe(__uint128_t state, uint8_t selection, int& value) const;
+
+    [[nodiscard]] size_t get_size() const;
+    [[nodiscard]] bool is_open() const;
+
+    /**
+     * @return the record at index, records are in key order
+     */
+    [[nodiscard]] record get_record(size_t index) const;
+
+    /**
+     * The on disk layout of a single record, shared with the result log
+     */
+    static void encode_record(const record& r, unsigned char bytes[RECORD_SIZE]);
+    static record decode_record(const unsigned char bytes[RECORD_SIZE]);
+
+    /**
+     * Sorts the records and writes them as a book. The book is written next to filename first and renamed over it, so
+     * a process that has the old book mapped keeps reading the old one. Of records with the same key the last one is
+     * kept.
+     */
+    static bool write(const std::string& filename, std::vector<record> records);
+
+private:
+    const unsigned char* data = nullptr;
+    size_t mapped_size = 0;
+    size_t record_count = 0;
+#ifdef _WIN32
+    // no mmap, the book is read into memory instead
+    std::vector<unsigned char> buffer;
+#endif
+};
+
+
+#endif //SHMINIMAXING_POSITION_BOOK_H
@@ -0,0 +1,245 @@
+#include "result_log.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+result_log::thread_batch::~thread_batch()
+{
+    if (owner != nullptr && !bytes.empty())
+    {
+        owner->hand_over(bytes);
+    }
+}
+
+result_log::thread_batch& result_log::current_batch()
+{
+    thread_local thread_batch batch;
+    return batch;
+}
+
+result_log::~result_log()
+{
+    close();
+}
+
+bool result_log::open(const std::string& filename)
+{
+    close();
+
+    // drop a record a crash cut short, or everything appended after it would be read shifted
+    std::error_code error;
+    if (const auto size = std::filesystem::file_size(filename, error);
+        !error && size % position_book::RECORD_SIZE != 0)
+    {
+        std::filesystem::resize_file(filename, size - size % position_book::RECORD_SIZE, error);
+    }
+
+#ifdef _WIN32
+    file = std::fopen(filename.c_str(), "ab");
+    if (file == nullptr)
+#else
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1)
+#endif
+    {
+        std::cerr << "error opening log " << filename << ", solved positions will not be persisted" << std::endl;
+        return false;
+    }
+
+    this->filename = filename;
+    stopping = false;
+    writer = std::thread(&result_log::write_loop, this);
+    opened = true;
+
+    return true;
+}
+
+void result_log::close()
+{
+    if (!opened)
+    {
+        return;
+    }
+
+    flush();
+    {
+        std::lock_guard lock(mtx);
+        stopping = true;
+    }
+    queued_cv.notify_one();
+    writer.join();
+
+#ifdef _WIN32
+    std::fclose(file);
+    file = nullptr;
+#else
+    ::close(fd);
+    fd = -1;
+#endif
+
+    opened = false;
+}
+
+bool result_log::is_open() const
+{
+    return opened;
+}
+
+void result_log::append(const position_book::record& r)
+{
+    auto& batch = current_batch();
+
+    if (batch.owner != this)
+    {
+        if (batch.owner != nullptr && !batch.bytes.empty())
+        {
+            batch.owner->hand_over(batch.bytes);
+        }
+
+        batch.owner = this;
+        batch.bytes.reserve(BATCH_RECORDS * position_book::RECORD_SIZE);
+    }
+
+    unsigned char bytes[position_book::RECORD_SIZE];
+    position_book::encode_record(r, bytes);
+    batch.bytes.insert(batch.bytes.end(), std::begin(bytes), std::end(bytes));
+
+    if (batch.bytes.size() >= BATCH_RECORDS * position_book::RECORD_SIZE)
+    {
+        hand_over(batch.bytes);
+    }
+}
+
+void result_log::flush()
+{
+    if (auto& batch = current_batch(); batch.owner == this && !batch.bytes.empty())
+    {
+        hand_over(batch.bytes);
+    }
+}
+
+void result_log::sync()
+{
+    flush();
+
+    std::unique_lock lock(mtx);
+    const uint64_t target = queued_bytes;
+    written_cv.wait(lock, [this, target] { return written_bytes >= target; });
+}
+
+bool result_log::truncate()
+{
+    if (!opened)
+    {
+        return false;
+    }
+
+    sync();
+
+#ifdef _WIN32
+    // reopening for writing empties the file
+    std::FILE* emptied = std::freopen(filename.c_str(), "wb", file);
+    if (emptied == nullptr || std::freopen(filename.c_str(), "ab", emptied) == nullptr)
+    {
+        std::cerr << "error truncating log " << filename << std::endl;
+        return false;
+    }
+#else
+    if (ftruncate(fd, 0) != 0)
+    {
+        std::cerr << "error truncating log " << filename << std::endl;
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+bool result_log::replay(const std::string& filename,
+                        const std::function<void(const position_book::record&)>& callback)
+{
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    const std::vector<unsigned char> data(std::istreambuf_iterator<char>(file), {});
+
+    // a trailing partial record is a write a crash cut short
+    for (size_t offset = 0; offset + position_book::RECORD_SIZE <= data.size(); offset += position_book::RECORD_SIZE)
+    {
+        callback(position_book::decode_record(data.data() + offset));
+    }
+
+    return true;
+}
+
+void result_log::hand_over(std::vector<unsigned char>& batch)
+{
+    {
+        std::lock_guard lock(mtx);
+        queued.insert(queued.end(), batch.begin(), batch.end());
+        queued_bytes += batch.size();
+    }
+
+    batch.clear();
+    queued_cv.notify_one();
+}
+
+void result_log::write_loop()
+{
+    std::vector<unsigned char> writing;
+    std::unique_lock lock(mtx);
+
+    while (true)
+    {
+        queued_cv.wait(lock, [this] { return !queued.empty() || stopping; });
+
+        if (queued.empty())
+        {
+            return; // stopping with nothing left to write
+        }
+
+        writing.swap(queued);
+        lock.unlock();
+
+        write_all(writing);
+
+        lock.lock();
+        written_bytes += writing.size();
+        writing.clear();
+        written_cv.notify_all();
+    }
+}
+
+void result_log::write_all(const std::vector<unsigned char>& bytes)
+{
+#ifdef _WIN32
+    if (std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size() || std::fflush(file) != 0)
+    {
+        std::cerr << "error writing log " << filename << std::endl;
+    }
+#else
+    size_t offset = 0;
+
+    while (offset < bytes.size())
+    {
+        const ssize_t written = ::write(fd, bytes.data() + offset, bytes.size() - offset);
+
+        if (written <= 0)
+        {
+            std::cerr << "error writing log " << filename << std::endl;
+            return;
+        }
+
+        offset += static_cast<size_t>(written);
+    }
+#endif
+}
@@ -0,0 +1,111 @@
+#ifndef SHMINIMAXING_RESULT_LOG_H
+#define SHMINIMAXING_RESULT_LOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "position_book.h"
+
+#define LOG_FILE_EXTENSION ".shml"
+
+/**
+ * Append only log of solved positions, so results survive a restart without rewriting the book after every search.
+ *
+ * The file is nothing but position_book records one after the other. Searching threads collect records in a thread
+ * local batch and hand full batches to a background thread that appends them with one write, so appending never
+ * touches the disk. Every write is a whole number of records opened with O_APPEND, so several processes can share a
+ * log. A record cut short by a crash is skipped on replay and dropped when the log is opened again.
+ *
+ * A log has to outlive the threads appending to it.
+ */
+class result_log
+{
+public:
+    constexpr static size_t BATCH_RECORDS{256};
+
+    result_log() = default;
+    ~result_log();
+
+    result_log(const result_log&) = delete;
+    result_log& operator=(const result_log&) = delete;
+
+    /**
+     * Opens the file for appending and starts the writer, a log that was open before is closed first
+     */
+    bool open(const std::string& filename);
+
+    /**
+     * Writes everything handed over and stops the writer
+     */
+    void close();
+    [[nodiscard]] bool is_open() const;
+
+    /**
+     * Adds the record to the batch of the calling thread, the batch is handed to the writer once it is full or the
+     * thread exits
+     */
+    void append(const position_book::record& r);
+
+    /**
+     * Hands the batch of the calling thread to the writer without waiting for it to be written
+     */
+    void flush();
+
+    /**
+     * flush, then waits until everything handed over so far is written
+     */
+    void sync();
+
+    /**
+     * Empties the file, not safe to call while other threads append
+     */
+    bool truncate();
+
+    /**
+     * Calls callback for every complete record in the file
+     *
+     * @return false if the file can't be read
+     */
+    static bool replay(const std::string& filename, const std::function<void(const position_book::record&)>& callback);
+
+private:
+    struct thread_batch
+    {
+        result_log* owner = nullptr;
+        std::vector<unsigned char> bytes;
+
+        ~thread_batch();
+    };
+
+    std::string filename;
+    std::atomic<bool> opened{false};
+#ifdef _WIN32
+    std::FILE* file = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    std::mutex mtx;
+    std::condition_variable queued_cv;
+    std::condition_variable written_cv;
+    std::vector<unsigned char> queued;
+    uint64_t queued_bytes = 0;
+    uint64_t written_bytes = 0;
+    bool stopping = false;
+    std::thread writer;
+
+    static thread_batch& current_batch();
+    void hand_over(std::vector<unsigned char>& batch);
+    void write_loop();
+    void write_all(const std::vector<unsigned char>& bytes);
+};
+
+
+#endif //SHMINIMAXING_RESULT_LOG_H
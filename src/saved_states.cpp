@@ -1,10 +1,18 @@
 #include "saved_states.h"
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <mutex>
 #include <sstream>
+#include <unordered_set>
+
+namespace
+{
+    constexpr unsigned char STATE_FILE_HEADER[8]{'S', 'H', 'M', 'X', 0, 0, 0, STATE_FILE_VERSION};
+}
 
 saved_states* saved_states::instance = nullptr;
 // https://stackoverflow.com/questions/17799134/c-singleton-undefined-reference-to
@@ -15,74 +23,119 @@ saved_states* saved_states::get_instance()
     {
         instance = new saved_states();
         instance->load(DEFAULT_SAVE_FILENAME);
+#ifdef PERSIST_SOLVED_POSITIONS
+        instance->open_log(DEFAULT_SAVE_FILENAME);
+#endif
     }
     return instance;
 }
 
 size_t saved_states::get_size() const
 {
-    std::shared_lock lock(this->mtx);
-    return state_map.size();
+    std::unordered_set<__uint128_t> boards;
+    table.for_each([&boards](const transposition_table::entry& e) { boards.insert(e.state); });
+
+    return boards.size();
 }
 
-void saved_states::store_eval(const __uint128_t state, uint8_t selection, int eval)
+void saved_states::store_eval(const __uint128_t state, const uint8_t selection, const int eval, const uint8_t depth,
+                              const uint8_t bound, const uint16_t best_move)
 {
-    std::unique_lock lock(this->mtx);
+    table.store(state, selection, eval, depth, bound, best_move);
 
-    if (state_map.count(state) != 1)
+    if (log.is_open() && bound == transposition_table::BOUND_EXACT && eval != 0
+        && depth >= 16 - std::popcount(static_cast<uint16_t>(state >> 64)))
     {
-        state_map[state] = {};
+        log.append(position_book::record{state, selection, static_cast<int8_t>(eval)});
     }
-
-    this->state_map[state][selection] = eval;
 }
 
-void saved_states::clear_zeroes()
+bool saved_states::probe(const __uint128_t state, const uint8_t selection, transposition_table::entry& saved) const
 {
-    for (auto& saved_board : state_map) {
-        std::erase_if(saved_board.second, [](const auto& p) { return p.second == 0; });
+    if (table.probe(state, selection, saved))
+    {
+        return true;
     }
 
-    std::erase_if(state_map, [](const auto& p) { return p.second.empty(); });
+    if (int value; book.probe(state, selection, value))
+    {
+        saved = transposition_table::entry{
+            state, selection, static_cast<int8_t>(value), transposition_table::FULL_DEPTH,
+            transposition_table::BOUND_EXACT
+        };
+        return true;
+    }
+
+    return false;
 }
 
-int saved_states::get_value(const __uint128_t state, uint8_t selection)
+void saved_states::new_search()
 {
-    std::shared_lock lock(this->mtx);
-    return state_map.at(state).at(selection);
+    table.new_generation();
 }
 
-bool saved_states::has_key(const __uint128_t state, uint8_t selection)
+void saved_states::resize_table(const size_t size_mb)
 {
-    std::shared_lock lock(this->mtx);
+    table.resize(size_mb);
+}
 
-    if (state_map.count(state) != 1)
+void saved_states::load(const std::string& filename)
+{
+    if (book.open(filename + BOOK_FILE_EXTENSION))
     {
-        return false;
+        std::cout << "mapped book: " << book.get_size() << " saved states" << std::endl;
+    }
+    else if (std::ifstream file(filename + ".shmx", std::ios::in | std::ios::binary); file)
+    {
+        const std::vector<u_char> buffer(std::istreambuf_iterator<char>(file), {});
+        if (deserialize(buffer))
+        {
+            std::cout << "loaded: " << get_size() << " saved states" << std::endl;
+        }
+        else
+        {
+            std::cerr << filename << ".shmx is not a version " << STATE_FILE_VERSION
+                << " state file, its results would be wrong and are not loaded" << std::endl;
+        }
+    }
+    else
+    {
+        std::cerr << "error opening state file, the saved_state table will not be populated" << std::endl;
     }
 
-    return state_map.at(state).count(selection) == 1;
-}
+    size_t replayed = 0;
+    result_log::replay(filename + LOG_FILE_EXTENSION, [this, &replayed](const position_book::record& r)
+    {
+        table.store(r.state, r.selection, r.value, transposition_table::FULL_DEPTH);
+        ++replayed;
+    });
 
-void saved_states::load(std::string filename)
-{
-    std::ifstream file(filename + ".shmx", std::ios::in | std::ios::binary);
-    if (!file)
+    if (replayed != 0)
     {
-        std::cerr << "error opening state file, the saved_state table will not be populated" << std::endl;
-        return;
+        std::cout << "replayed: " << replayed << " logged states" << std::endl;
     }
+}
 
-    std::vector<u_char> buffer(std::istreambuf_iterator<char>(file), {});
-    deserialize(buffer);
-    std::cout << "loaded: " << state_map.size() << " saved states" << std::endl;
+bool saved_states::open_log(const std::string& filename)
+{
+    return log.open(filename + LOG_FILE_EXTENSION);
 }
 
-void saved_states::deserialize(std::vector<u_char> data)
+void saved_states::flush_log()
 {
-    std::cout << "started deserializing, data size: " << data.size() << std::endl;
+    log.flush();
+}
+
+bool saved_states::for_each_record(const std::vector<u_char>& data,
+                                   const std::function<void(__uint128_t, uint8_t, int8_t)>& callback)
+{
+    if (data.size() < sizeof(STATE_FILE_HEADER) ||
+        !std::equal(std::begin(STATE_FILE_HEADER), std::end(STATE_FILE_HEADER), data.begin()))
+    {
+        return false;
+    }
 
-    for (auto it = data.begin(); it != data.end();)
+    for (auto it = data.begin() + sizeof(STATE_FILE_HEADER); it != data.end();)
     {
         // 16 top bits
         uint16_t upper = static_cast<uint16_t>(*it) << 8 | static_cast<uint16_t>(*(it + 1));
@@ -109,11 +162,24 @@ void saved_states::deserialize(std::vector<u_char> data)
 
             assert(eval != 0);
 
-            state_map[canonized][placement] = eval;
+            callback(canonized, placement, eval);
         }
     }
 
-    std::cout << "deserialized: " << state_map.size() << std::endl;
+    return true;
+}
+
+bool saved_states::deserialize(const std::vector<u_char>& data)
+{
+    std::cout << "started deserializing, data size: " << data.size() << std::endl;
+
+    const bool current = for_each_record(data, [this](const __uint128_t state, const uint8_t selection, const int8_t eval)
+    {
+        table.store(state, selection, eval, transposition_table::FULL_DEPTH);
+    });
+
+    std::cout << "deserialized: " << table.get_size() << std::endl;
+    return current;
 }
 
 void saved_states::save(const std::string& filename)
@@ -128,53 +194,141 @@ void saved_states::save(const std::string& filename)
     serialize(file);
 
     file.close();
-    std::cout << "saved state: " << state_map.size() << std::endl;
+    std::cout << "saved state: " << get_size() << std::endl;
+}
+
+std::vector<transposition_table::entry> saved_states::solved_entries() const
+{
+    // only solved positions go to disk, they are loaded back as exact results of unlimited depth
+    std::vector<transposition_table::entry> entries;
+    table.for_each([&entries](const transposition_table::entry& e)
+    {
+        const int empty_squares = 16 - std::popcount(static_cast<uint16_t>(e.state >> 64));
+
+        if (e.bound == transposition_table::BOUND_EXACT && e.depth >= empty_squares && e.value != 0)
+        {
+            entries.push_back(e);
+        }
+    });
+
+    return entries;
 }
 
 void saved_states::serialize(std::ofstream& file) const
 {
-    auto count = 0;
-    for (auto v : state_map)
+    auto entries = solved_entries();
+
+    // the file groups all selections of a board together
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b)
+    {
+        return a.state != b.state ? a.state < b.state : a.selection < b.selection;
+    });
+
+    size_t board_count = 0;
+    for (size_t i = 0; i < entries.size(); ++i)
     {
-        count += v.second.size();
+        if (i == 0 || entries[i].state != entries[i - 1].state)
+        {
+            ++board_count;
+        }
     }
 
-    std::cout << "expected save size: " << (count * 2 + 11 * state_map.size()) << " bytes" << std::endl;
+    std::cout << "expected save size: " << (sizeof(STATE_FILE_HEADER) + entries.size() * 2 + 11 * board_count)
+        << " bytes" << std::endl;
+
+    file.write(reinterpret_cast<const char*>(STATE_FILE_HEADER), sizeof(STATE_FILE_HEADER));
 
-    for (auto ss : state_map)
+    for (auto it = entries.begin(); it != entries.end();)
     {
-        auto canonized = ss.first;
-        uint16_t upper = static_cast<uint16_t>(canonized >> 64);
-        uint64_t lower = static_cast<uint64_t>(canonized);
-        uint8_t size = static_cast<uint8_t>(ss.second.size());
+        const auto group_end = std::find_if(it, entries.end(), [&it](const auto& e) { return e.state != it->state; });
+
+        // big endian, the way deserialize reads it
+        const auto canonized = it->state;
+        char header[11];
+        for (int i = 0; i < 10; ++i)
+        {
+            header[i] = static_cast<char>(canonized >> (72 - 8 * i));
+        }
+        header[10] = static_cast<char>(group_end - it);
 
-        file.write(reinterpret_cast<const char*>(&upper), sizeof(upper));
-        file.write(reinterpret_cast<const char*>(&lower), sizeof(lower));
-        file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        file.write(header, sizeof(header));
 
-        for (auto sp : ss.second)
+        for (; it != group_end; ++it)
         {
-            assert(sp.second != 0); // we dont want to be saving zeroes
+            assert(it->value != 0); // we dont want to be saving zeroes
 
-            file.write(reinterpret_cast<const std::ostream::char_type*>(&sp.first), sizeof(sp.first));
-            file.write(reinterpret_cast<const std::ostream::char_type*>(&sp.second), sizeof(sp.second));
+            file.write(reinterpret_cast<const std::ostream::char_type*>(&it->selection), sizeof(it->selection));
+            file.write(reinterpret_cast<const std::ostream::char_type*>(&it->value), sizeof(it->value));
         }
     }
 }
 
-void saved_states::clear()
+bool saved_states::save_book(const std::string& filename)
 {
-    this->state_map.clear();
+    std::vector<position_book::record> records;
+    records.reserve(book.get_size());
+
+    for (size_t i = 0; i < book.get_size(); ++i)
+    {
+        records.push_back(book.get_record(i));
+    }
+
+    // the log is written after the book and the table after the log so newer results win for keys that are in both
+    if (log.is_open())
+    {
+        log.sync();
+    }
+
+    result_log::replay(filename + LOG_FILE_EXTENSION, [&records](const position_book::record& r)
+    {
+        records.push_back(r);
+    });
+
+    for (const auto& e : solved_entries())
+    {
+        records.push_back(position_book::record{e.state, e.selection, e.value});
+    }
+
+    if (!position_book::write(filename + BOOK_FILE_EXTENSION, std::move(records)))
+    {
+        return false;
+    }
+
+    return book.open(filename + BOOK_FILE_EXTENSION);
 }
 
-int saved_states::get_total_size() const
+bool saved_states::compact(const std::string& filename)
 {
-    auto count = 0;
+    if (!save_book(filename))
+    {
+        return false;
+    }
+
+    // only emptied once the book holding its records is in place, a crash in between replays them twice at worst
+    if (log.is_open())
+    {
+        return log.truncate();
+    }
 
-    for (auto p : state_map)
+    if (!std::filesystem::exists(filename + LOG_FILE_EXTENSION))
     {
-        count += p.second.size();
+        return true;
     }
 
-    return count;
+    return std::ofstream(filename + LOG_FILE_EXTENSION, std::ios::out | std::ios::trunc).good();
+}
+
+size_t saved_states::get_book_size() const
+{
+    return book.get_size();
+}
+
+void saved_states::clear()
+{
+    table.clear();
+}
+
+int saved_states::get_total_size() const
+{
+    return static_cast<int>(table.get_size());
 }
@@ -2,33 +2,97 @@
 #define SHMINIMAXING_SAVED_STATES_H
 
 #include <cstdint>
-#include <shared_mutex>
+#include <functional>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
+#include "position_book.h"
+#include "result_log.h"
 #include "search.h"
+#include "transposition_table.h"
 
 #define DEFAULT_SAVE_FILENAME "ss_state"
+// .shmx files start with SHMX and this version, big endian
+#define STATE_FILE_VERSION 2
 
+/**
+ * The transposition table of the running searches in front of the read only book of solved positions, with an optional
+ * log that persists newly solved positions until they are compacted into the book
+ */
 class saved_states
 {
-    std::unordered_map<__uint128_t, std::unordered_map<uint8_t, int8_t>> state_map;
+    transposition_table table;
+    position_book book;
+    result_log log;
     static saved_states* instance;
-    mutable std::shared_mutex mtx;
+
+    /**
+     * @return the exact, complete and non zero entries of the table, the only ones worth keeping on disk
+     */
+    std::vector<transposition_table::entry> solved_entries() const;
 
 public:
     static saved_states* get_instance();
+    /**
+     * @return the number of distinct boards stored
+     */
     size_t get_size() const;
 
-    int get_value(__uint128_t state, uint8_t selection);
-    bool has_key(__uint128_t state, uint8_t selection);
-    void store_eval(__uint128_t state, uint8_t selection, int eval);
-    void clear_zeroes();
+    /**
+     * @return true and writes the stored entry if the (state, selection) pair is in the table or the book, safe to call
+     * from any thread
+     */
+    bool probe(__uint128_t state, uint8_t selection, transposition_table::entry& saved) const;
+    void store_eval(__uint128_t state, uint8_t selection, int eval, uint8_t depth, uint8_t bound,
+                    uint16_t best_move = transposition_table::NO_MOVE);
+    void new_search();
+    void resize_table(size_t size_mb);
 
     void save(const std::string& filename);
     void serialize(std::ofstream& file) const;
-    void deserialize(std::vector<u_char> data);
-    void load(std::string filename);
+    bool deserialize(const std::vector<u_char>& data);
+
+    /**
+     * Calls callback for every (state, selection, eval) record of the .shmx layout. Files from before the header was
+     * added store values for the other player and selections mapped another way, so they are refused.
+     *
+     * @return false if data doesn't start with the header of the current version
+     */
+    static bool for_each_record(const std::vector<u_char>& data,
+                                const std::function<void(__uint128_t, uint8_t, int8_t)>& callback);
+
+    /**
+     * Maps filename.shmb if there is one, otherwise reads filename.shmx into the table. The results in filename.shml
+     * are replayed into the table on top of either.
+     */
+    void load(const std::string& filename);
+
+    /**
+     * Appends every solved position stored from now on to filename.shml
+     */
+    bool open_log(const std::string& filename);
+
+    /**
+     * Hands the solved positions of the calling thread to the log writer, never waits for the disk
+     */
+    void flush_log();
+
+    /**
+     * Writes the book, filename.shml and the solved entries of the table as filename.shmb, maps the new book and
+     * empties the log. Not safe to call while a search is running.
+     */
+    bool compact(const std::string& filename);
+
+    /**
+     * Writes the book and the solved entries of the table as filename.shmb and maps the new book, not safe to call
+     * while a search is running
+     */
+    bool save_book(const std::string& filename);
+    [[nodiscard]] size_t get_book_size() const;
+
+    /**
+     * Clears the table, the book stays
+     */
     void clear();
     int get_total_size() const;
 };
@@ -1,517 +1,1259 @@
 #include "search.h"
 
+#include <algorithm>
 #include <bitset>
+#include <functional>
 #include <iostream>
 #include <math.h>
 #include <mutex>
 #include <thread>
 
+#include "mcts_session.h"
 #include "saved_states.h"
 #include "symmetries.h"
+#include "thread_pool.h"
 
 //#define DISABLE_ALPHA_BETA_SEARCH
+//#define LAZY_SMP_SEARCH
 
 namespace quarto
 {
-    std::shared_ptr<search_node> search::best_uct(const std::shared_ptr<search_node>& node)
+    uint32_t search::best_uct(const node_arena& arena, const uint32_t node, const int side)
     {
-        assert(node->get_children().size() > 0);
+        const auto& parent = arena[node];
+        assert(parent.child_count > 0);
 
+        // the children are one block, and the log only depends on the parent
+        const auto* children = &arena[parent.first_child];
+        const auto exploration = 1.414 * sqrt(log(parent.n_visits()));
         auto best = -INFINITY;
-        std::shared_ptr<search_node> best_uct;
+        uint32_t best_uct = search_node::NO_NODE;
 
-        for (const auto c : node->get_children())
+        for (uint32_t c = 0; c < parent.child_count; ++c)
         {
-            if (const auto score = c->get_uct(1.414); best < score)
+            // nothing left to learn in a solved subtree
+            if (children[c].is_proven())
+            {
+                continue;
+            }
+
+            if (const auto score = children[c].get_uct(exploration, side); best < score)
             {
                 best = score;
-                best_uct = c;
+                best_uct = parent.first_child + c;
             }
         }
 
-        assert(best_uct != nullptr);
-
         return best_uct;
     }
 
-    std::shared_ptr<search_node> search::traverse(const std::shared_ptr<search_node>& root,
-                                                  const std::shared_ptr<game>& game_state)
+    uint32_t search::traverse(node_arena& arena, const uint32_t root, game& game_state)
     {
-        assert(!root->get_children().empty());
+        assert(arena[root].is_expanded());
+        const auto loss = virtual_loss.load(std::memory_order_relaxed);
         auto picked_node = root;
-        while (picked_node->is_expanded())
+        // nobody picks the root, its loss is one for the player to move there
+        arena[root].add_virtual_loss(loss, 1);
+
+        while (true)
         {
-            if (picked_node->get_children().empty()) // terminal node
+            auto& node = arena[picked_node];
+
+            if (!node.is_expanded())
+            {
+                // another thread expanding the node plays out from it meanwhile
+                if (!node.begin_expansion())
+                {
+                    return picked_node;
+                }
+                populate_children(arena, picked_node, game_state);
+            }
+
+            // terminal node, solved node or the arena is full
+            if (node.child_count == 0 || node.is_proven())
             {
                 return picked_node;
             }
 
-            picked_node = best_uct(picked_node);
-            assert(picked_node != root);
+            const auto unvisited = node.take_unvisited_child();
+            const auto picked_child = unvisited != search_node::NO_NODE
+                                          ? unvisited
+                                          : best_uct(arena, picked_node, game_state.move_side());
+            assert(picked_child != root);
 
-            assert(picked_node->placement_move < 16);
-            assert(picked_node->selection_move != INVALID_PIECE_SELECTION);
+            // every child got solved, the node will be as soon as the last proof comes up
+            if (picked_child == search_node::NO_NODE)
+            {
+                return picked_node;
+            }
 
-            game_state->do_move(picked_node->placement_move);
-            game_state->do_select(picked_node->selection_move);
-        }
+            arena[picked_child].add_virtual_loss(loss, game_state.move_side());
 
-        std::lock_guard lock(picked_node->expansion_mtx);
+            const auto move = arena[picked_child].move;
+            game_state.do_move(move >> 4);
+            game_state.do_select(move & 0xf);
 
-        if (picked_node->get_children().empty())
-        {
-            populate_children(picked_node, game_state);
+            if (unvisited != search_node::NO_NODE)
+            {
+                return picked_child;
+            }
+
+            picked_node = picked_child;
         }
+    }
 
-        auto picked_child = picked_node->pick_unvisited_child();
+    bool search::generate_tree_moves(const game& game_state, move_list& moves)
+    {
+        moves.size = 0;
 
-        if (picked_child == nullptr)
+        const auto winning_squares = game_state.winning_squares(game_state.get_selection_piece());
+        if (winning_squares != 0)
         {
-            return picked_node;
+            // the piece wins, only one winning move per square is kept so there is a move to play at the root
+            if (game_state.get_selection_state() != 0)
+            {
+                const auto selection = static_cast<uint8_t>(std::countl_zero(game_state.get_selection_state()));
+                for (uint16_t squares = winning_squares; squares != 0;)
+                {
+                    moves.push_back(pop_square(squares), selection);
+                }
+            }
+            return true;
         }
 
-        assert(picked_child != root);
+        // a lost position keeps all its moves so the playouts still see the loss
+        game_state.generate_safe_moves(moves);
+        if (moves.empty())
+        {
+            game_state.generate_moves(moves);
+        }
+        game_state.remove_symmetric_moves(moves);
+        return false;
+    }
 
-        assert(picked_child->placement_move < 16);
-        assert(picked_child->selection_move != INVALID_PIECE_SELECTION);
+    void search::populate_children(node_arena& arena, const uint32_t node, game& game_state)
+    {
+        auto& parent = arena[node];
+        assert(!parent.is_expanded());
+        assert(game_state.get_selection_piece() != INVALID_PIECE_SELECTION);
 
-        game_state->do_move(picked_child->placement_move);
-        game_state->do_select(picked_child->selection_move);
+        if (game_state.is_quarto())
+        {
+            parent.set_proof(search_node::PROVEN_LOSS);
+            parent.finish_expansion(search_node::NO_NODE, 0);
+            return;
+        }
 
-        assert(picked_child != nullptr);
-        return picked_child;
-    }
+        if (game_state.is_game_over())
+        {
+            parent.finish_expansion(search_node::NO_NODE, 0);
+            return;
+        }
 
-    void search::populate_children(const std::shared_ptr<search_node>& node,
-                                   const std::shared_ptr<game>& game_state)
-    {
-        assert(node->get_children().size() == 0);
-        assert(game_state->get_selection_piece() != INVALID_PIECE_SELECTION);
+        move_list moves;
+        const bool winning = generate_tree_moves(game_state, moves);
+        if (winning)
+        {
+            parent.set_proof(search_node::PROVEN_WIN);
+        }
 
-        if (game_state->is_game_over() || game_state->is_quarto())
+        // only the last placement is left, which has no selection to go with it
+        if (moves.empty())
         {
+            parent.finish_expansion(search_node::NO_NODE, 0);
             return;
         }
 
-        const auto piece_bitboards = game_state->get_board_state()[game::BOARD_PLACED];
-        const auto selection_board = game_state->get_selection_state();
+        // with the arena full the node stays a leaf
+        const auto first_child = arena.allocate(moves.size);
+        if (first_child == search_node::NO_NODE)
+        {
+            parent.finish_expansion(search_node::NO_NODE, 0);
+            return;
+        }
 
-        for (uint8_t placement_index = 0; placement_index < 16; ++placement_index)
+        for (uint32_t i = 0; i < moves.size; ++i)
         {
-            constexpr auto start_index = 0x8000;
-            if ((piece_bitboards & (start_index >> placement_index)) != 0)
+            auto& child = arena[first_child + i];
+            child.parent = node;
+            child.move = moves.moves[i];
+            if (winning)
             {
-                continue;
+                child.set_proof(search_node::PROVEN_LOSS);
             }
+        }
 
-            game_state->do_move(placement_index);
+        parent.finish_expansion(first_child, moves.size);
+    }
 
-            for (uint8_t selection_index = 0; selection_index < 16; ++selection_index)
+    int search::eval(const game& game_state)
+    {
+        if (game_state.is_quarto())
+        {
+            if (game_state.move_side() == 1)
             {
-                if ((selection_board & (start_index >> selection_index)) == 0)
-                {
-                    continue;
-                }
-
-                game_state->do_select(selection_index);
-
-                auto child = std::make_shared<search_node>(search_node(node));
-                child->selection_move = selection_index;
-                child->placement_move = placement_index;
+                return LOSS_SCORE;
+            }
+            return WIN_SCORE;
+        }
 
-                node->get_children().push_back(child);
+        return DRAW_SCORE;
+    }
 
-                assert(node->get_children().size() > 0);
+    /**
+     * For every byte its population, and its n-th set bit counted from the highest one (as a square index 0-7)
+     */
+    constexpr auto BYTE_SQUARES = []
+    {
+        struct
+        {
+            uint8_t count[256]{};
+            uint8_t nth[256][8]{};
+        } tables;
 
-                game_state->undo();
+        for (int byte = 0; byte < 256; ++byte)
+        {
+            for (int square = 0; square < 8; ++square)
+            {
+                if ((byte & 0x80 >> square) != 0)
+                {
+                    tables.nth[byte][tables.count[byte]++] = square;
+                }
             }
-            game_state->undo();
         }
 
-        assert(node->get_children().size() < 241);
+        return tables;
+    }();
+
+    /**
+     * @return a random square (or piece) of the bitboard, count is its population and must not be 0
+     */
+    uint8_t random_square(const uint16_t bitboard, const int count, xoshiro256& rng)
+    {
+        const auto nth = static_cast<int>(rng.below(count));
+        const uint8_t high = bitboard >> 8;
+        const int high_count = BYTE_SQUARES.count[high];
+
+        // no branch, which half it lands in is a coin flip
+        const bool in_high = nth < high_count;
+        const uint8_t byte = in_high ? high : static_cast<uint8_t>(bitboard);
+        return (in_high ? 0 : 8) + BYTE_SQUARES.nth[byte][in_high ? nth : nth - high_count];
     }
 
-    int search::eval(const std::shared_ptr<game>& game_state)
+    /**
+     * Adds the empty square of the line, if three of its squares are taken, to the winning squares of every attribute
+     * its pieces share
+     */
+    void add_winning_square(uint16_t wins[8], const uint16_t placed, const int line, const uint8_t shared)
     {
-        if (game_state->is_quarto())
+        if (const uint16_t square = last_empty_square(placed, QUARTO_MAGIC_VALUES[line]); square != 0)
         {
-            if (game_state->move_side() == 1)
+            for (uint8_t attributes = shared; attributes != 0; attributes &= attributes - 1)
             {
-                return -10;
+                wins[std::countr_zero(attributes)] |= square;
             }
-            return 3;
         }
-
-        return 1;
     }
 
-    int search::rollout(const std::shared_ptr<search_node>& node, const std::shared_ptr<game>& game_state)
+    /**
+     * Only what decides a random game: the taken squares, the pieces and per line the attributes its pieces share.
+     * wins[i] are the empty squares where a piece with line attribute i (see PIECE_LINE_ATTRIBUTES) makes a quarto,
+     * placing a piece only ever takes its own square out of them.
+     */
+    struct playout_state
     {
-        node->set_visited(true);
-
-        while (!game_state->is_game_over() && !game_state->is_quarto())
+        uint16_t placed;
+        uint16_t pieces;
+        uint8_t piece;
+        uint8_t shared[10];
+        uint16_t wins[8]{};
+        int empty_count;
+        int piece_count;
+
+        explicit playout_state(const position& state)
+            : placed(state.board_state[game::BOARD_PLACED]), pieces(state.selection_state),
+              piece(state.selected_piece), empty_count(16 - std::popcount(placed)), piece_count(std::popcount(pieces))
         {
-            const auto piece_bitboards = game_state->get_board_state()[game::BOARD_PLACED];
-            const auto selection_board = game_state->get_selection_state();
-
-            std::vector<std::pair<uint8_t, uint8_t>> legal_moves;
-            std::vector<std::pair<uint8_t, uint8_t>> winning_moves;
-
-            for (uint8_t placement = 0; placement < 16; ++placement)
+            for (int line = 0; line < 10; ++line)
             {
-                constexpr auto start_index = 0x8000;
-                if ((piece_bitboards & (start_index >> placement)) != 0)
-                    continue;
-
-                for (uint8_t selection = 0; selection < 16; ++selection)
-                {
-                    if ((selection_board & (start_index >> selection)) == 0)
-                        continue;
-                    legal_moves.emplace_back(placement, selection);
+                shared[line] = state.line_shared[line];
+                add_winning_square(wins, placed, line, shared[line]);
+            }
+        }
+    };
+
+    /**
+     * Plays random moves to the end of the game, taking a quarto whenever the piece to place allows one
+     *
+     * @return the search::eval score of the finished game
+     */
+    int play_random_game(playout_state state, int side, xoshiro256& rng)
+    {
+        while (state.piece != INVALID_PIECE_SELECTION)
+        {
+            // a piece has exactly one of the line attributes i and 4 + i
+            const uint8_t attributes = PIECE_LINE_ATTRIBUTES[state.piece];
+            uint16_t winning = 0;
+            for (int attribute = 0; attribute < 4; ++attribute)
+            {
+                winning |= state.wins[(attributes >> attribute & 1) != 0 ? attribute : 4 + attribute];
+            }
 
-                    game_state->do_move(placement);
-                    game_state->do_select(selection);
+            // a square that wins with the piece is always taken, so no other placement can make a quarto
+            if (winning != 0)
+            {
+                return side == 1 ? search::WIN_SCORE : search::LOSS_SCORE;
+            }
 
-                    if (game_state->is_quarto())
-                    {
-                        winning_moves.emplace_back(placement, selection);
-                    }
+            const auto square = random_square(~state.placed, state.empty_count--, rng);
+            const uint16_t square_bit = 0x8000 >> square;
+            state.placed |= square_bit;
 
-                    game_state->undo();
-                    game_state->undo();
-                }
+            for (auto& squares : state.wins)
+            {
+                squares &= ~square_bit;
             }
 
-            if (legal_moves.empty())
-                break;
-
-            if (winning_moves.empty())
+            for (uint16_t lines = SQUARE_LINES[square]; lines != 0; lines &= lines - 1)
             {
-                auto [placement, selection] = legal_moves[std::rand() % legal_moves.size()];
-                game_state->do_move(placement);
-                game_state->do_select(selection);
+                const int line = std::countr_zero(lines);
+                state.shared[line] &= attributes;
+                add_winning_square(state.wins, state.placed, line, state.shared[line]);
             }
-            else
+
+            if (state.piece_count == 0)
             {
-                auto [placement, selection] = winning_moves[std::rand() % winning_moves.size()];
-                game_state->do_move(placement);
-                game_state->do_select(selection);
+                break;
             }
+
+            state.piece = random_square(state.pieces, state.piece_count--, rng);
+            state.pieces &= ~(0x8000 >> state.piece);
+            side = -side;
         }
 
-        const int result = eval(game_state);
-        return result;
+        return search::DRAW_SCORE;
     }
 
-    void search::backpropagate(const std::shared_ptr<search_node>& node, const int result)
+    int search::playout(const position& state, const int side, xoshiro256& rng)
     {
-        auto current = node;
-        while (current)
+        if (state.quarto)
         {
-            current->add_t_score(result);
-            current->add_visits(1);
-            current = current->get_parent();
+            return side == 1 ? LOSS_SCORE : WIN_SCORE;
         }
+
+        return play_random_game(playout_state(state), side, rng);
     }
 
-    uint8_t search::best_child(const std::shared_ptr<search_node>& node)
+    search::playout_counts search::playout_batch(const position& state, const int side, const int count, xoshiro256& rng)
     {
-        assert(node->get_children().size() > 0);
+        playout_counts counts;
 
-        int max_visits = 0;
-        auto best_node = node->get_children()[0];
+        if (state.quarto)
+        {
+            (side == 1 ? counts.losses : counts.wins) = count;
+            return counts;
+        }
 
-        for (const auto& child : node->get_children())
+        const playout_state prepared(state);
+        for (int i = 0; i < count; ++i)
         {
-            //std::cout << "score: " << child->get_t_score() << " visits: " << child->n_visits() << std::endl;
-            if (child->n_visits() > max_visits)
-            {
-                max_visits = child->n_visits();
-                best_node = child;
-            }
+            const auto result = play_random_game(prepared, side, rng);
+            counts.wins += result == WIN_SCORE;
+            counts.losses += result == LOSS_SCORE;
         }
+        counts.draws = count - counts.wins - counts.losses;
 
-        // std::cout << "max visits: " << max_visits << "n of children: " << node->get_children().size() << std::endl;
-        return best_node->format();
+        return counts;
     }
 
-    uint8_t search::search_mnt(const std::shared_ptr<game>& game_state, const int search_time)
+    search::playout_counts search::rollout(const game& game_state, const int count)
     {
-        const auto start = std::chrono::high_resolution_clock::now();
-        const auto root = std::make_shared<search_node>(search_node(nullptr));
-        populate_children(root, game_state);
-
-        std::atomic<int> count = 0;
-
-        std::vector<std::thread> search_threads;
+        return playout_batch(game_state.get_position(), game_state.move_side(), count, playout_rng);
+    }
 
-        for (int i = 0; i < 16; ++i)
+    /**
+     * Solves the nodes above a solved node that it decides: a child lost for the player to move there wins its parent,
+     * a parent whose children are all won for the player to move there is lost
+     */
+    void propagate_proof(node_arena& arena, uint32_t node)
+    {
+        for (; arena[node].is_proven() && arena[node].parent != search_node::NO_NODE; node = arena[node].parent)
         {
-            auto game_copy = game_state->clone();
-
-            search_threads.emplace_back([search_time, game_copy, &root, start, &count]()
+            auto& parent = arena[arena[node].parent];
+            if (parent.is_proven())
             {
-                while (true)
-                {
-                    if (std::chrono::duration_cast<std::chrono::milliseconds>(
-                            std::chrono::high_resolution_clock::now() - start)
-                        .
-                        count() >
-                        search_time)
-                    {
-                        break;
-                    }
-
-                    count += 1;
-
-                    assert(!game_copy->can_undo());
+                continue;
+            }
 
-                    auto leaf = traverse(root, game_copy);
-                    const auto result = rollout(leaf, game_copy);
-                    backpropagate(leaf, result);
+            if (arena[node].get_proof() == search_node::PROVEN_LOSS)
+            {
+                parent.set_proof(search_node::PROVEN_WIN);
+                continue;
+            }
 
-                    while (game_copy->can_undo())
-                    {
-                        game_copy->undo();
-                    }
+            for (auto c = parent.first_child; c < parent.first_child + parent.child_count; ++c)
+            {
+                if (arena[c].get_proof() != search_node::PROVEN_WIN)
+                {
+                    return;
                 }
-            });
+            }
+            parent.set_proof(search_node::PROVEN_LOSS);
         }
+    }
 
-        for (auto& t : search_threads)
+    void search::backpropagate(node_arena& arena, const uint32_t node, const playout_counts& counts)
+    {
+        // traverse already counted one visit
+        const auto loss = virtual_loss.load(std::memory_order_relaxed);
+        const auto score = counts.score();
+        const auto games = counts.games();
+
+        // the player to move at the root picks the nodes at odd depths, the opponent the ones at even depths but the root
+        int depth = 0;
+        for (auto current = arena[node].parent; current != search_node::NO_NODE; current = arena[current].parent)
         {
-            if (t.joinable())
-            {
-                t.join();
-            }
+            ++depth;
         }
 
-        std::cout << count << " total visits: " << root->n_visits() << "test" << std::endl;
+        for (auto current = node; current != search_node::NO_NODE; current = arena[current].parent, --depth)
+        {
+            arena[current].add_result(score, games, loss, depth == 0 || depth % 2 == 1 ? 1 : -1);
+        }
+
+        propagate_proof(arena, node);
+    }
 
-        return best_child(root);
+    search::playout_counts search::proven_result(const search_node& node, const game& game_state, const int count)
+    {
+        assert(node.is_proven());
+
+        // game_state is at the node, the player to move at the root is to move there if move_side is 1
+        playout_counts counts;
+        const bool root_player_wins = (node.get_proof() == search_node::PROVEN_WIN) == (game_state.move_side() == 1);
+        (root_player_wins ? counts.wins : counts.losses) = count;
+
+        return counts;
     }
 
-    uint8_t search::selective_search(const std::shared_ptr<game>& game_state, const int time_remaining)
+    uint8_t search::best_child(const node_arena& arena, const uint32_t node)
     {
-        if (std::popcount(game_state->get_board_state()[game::BOARD_PLACED]) >= 7)
+        const auto& parent = arena[node];
+        assert(parent.child_count > 0);
+
+        // a move into a position lost for the opponent wins, one into a position won for the opponent is only played
+        // when all of them are, otherwise the most visited
+        const auto rank = [](const search_node& child)
         {
-            return search_dfs(game_state);
+            return child.get_proof() == search_node::PROVEN_LOSS ? 2 : child.get_proof() == search_node::UNPROVEN ? 1 : 0;
+        };
+
+        auto best_node = parent.first_child;
+
+        for (uint32_t c = parent.first_child + 1; c < parent.first_child + parent.child_count; ++c)
+        {
+            const auto& child = arena[c];
+            const auto& best = arena[best_node];
+            if (rank(child) > rank(best) || (rank(child) == rank(best) && child.n_visits() > best.n_visits()))
+            {
+                best_node = c;
+            }
         }
 
-        return search_mnt(game_state, time_remaining);
+        return arena[best_node].move;
     }
 
-    uint8_t format_move(const uint8_t placement_move, const uint8_t selection_move)
+    uint8_t search::search_mnt(game& game_state, const int search_time)
     {
-        return (placement_move << 4) | selection_move;
+        // the whole tree goes away with the arena when the search returns
+        node_arena arena;
+        const auto root = arena.allocate(1);
+        populate_children(arena, root, game_state);
+
+        return search_mnt(arena, root, game_state, search_time);
     }
 
-    int search::max(game& game_state)
+    uint8_t search::search_mnt(node_arena& arena, const uint32_t root, game& game_state, const int search_time)
     {
-        auto init_depth = 10;
-        auto pop = std::popcount(game_state.get_board_state()[4]);
+        assert(arena[root].is_expanded());
+        const auto start = std::chrono::high_resolution_clock::now();
+        std::atomic<uint64_t> count = 0;
+
+        task_group search_tasks;
+        auto& pool = thread_pool::get_instance();
+        const auto requested = mcts_threads.load(std::memory_order_relaxed);
+        const auto thread_count = requested == 0 ? pool.get_thread_count() : std::min(requested, pool.get_thread_count());
 
-        if (pop >= 7)
+        // one playout loop per thread
+        for (size_t i = 0; i < thread_count; ++i)
         {
-            init_depth = 10;
+            search_tasks.run([search_time, game_copy = game_state.clone(), &arena, root, start, &count]() mutable
+            {
+                const auto per_leaf = playouts_per_leaf.load(std::memory_order_relaxed);
+                uint64_t thread_playouts = 0;
+                // a solved root is done
+                while (!arena[root].is_proven() && std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::high_resolution_clock::now() - start).count() <= search_time)
+                {
+                    thread_playouts += per_leaf;
+
+                    assert(!game_copy.can_undo());
+
+                    const auto leaf = traverse(arena, root, game_copy);
+                    backpropagate(arena, leaf, arena[leaf].is_proven()
+                                                   ? proven_result(arena[leaf], game_copy, per_leaf)
+                                                   : rollout(game_copy, per_leaf));
+
+                    while (game_copy.can_undo())
+                    {
+                        game_copy.undo();
+                    }
+                }
+
+                count.fetch_add(thread_playouts, std::memory_order_relaxed);
+            });
         }
 
-        return max(game_state, -1000, 1000, init_depth);
+        search_tasks.wait();
+        playouts.fetch_add(count, std::memory_order_relaxed);
+
+        std::cout << count << " total visits: " << arena[root].n_visits() << " nodes: " << arena.get_size() << std::endl;
+
+        return best_child(arena, root);
     }
 
-    int search::max(game& game_state, int alpha, const int beta, const int depth)
+    void search::expand_dag(mcts_dag& dag, const uint32_t node)
     {
-        const auto canonized = game_state.canonize();
-        auto best_value = -1000;
-        // leafnode
+        auto& current = dag[node];
+        assert(!current.is_expanded());
 
-        if (game_state.is_quarto())
+        const game game_state(current.state);
+        move_list moves;
+        if (!game_state.is_quarto() && !game_state.is_game_over())
         {
-            best_value = -2;
-            goto EARLY_END;
+            generate_tree_moves(game_state, moves);
         }
 
-        if (game_state.is_game_over())
+        // with no room for the edges the position stays a leaf
+        const auto first_edge = moves.empty() ? search_node::NO_NODE : dag.allocate_edges(moves.size);
+        if (first_edge == search_node::NO_NODE)
         {
-            best_value = 0;
-            goto EARLY_END;
+            current.finish_expansion(search_node::NO_NODE, 0);
+            return;
         }
 
-        if (depth == 0)
+        for (uint32_t i = 0; i < moves.size; ++i)
         {
-            best_value = 0;
-            goto EARLY_END;
+            dag.edge(first_edge + i).move = moves.moves[i];
         }
 
-        if (saved_states::get_instance()->has_key(canonized, game_state.get_selection_piece()))
-        {
-            return saved_states::get_instance()->get_value(canonized, game_state.get_selection_piece());
-        }
+        current.finish_expansion(first_edge, moves.size);
+    }
 
-        for (char placement_index = 0; placement_index < 16; ++placement_index)
-        {
-            constexpr int start_index{0x8000};
-            if ((game_state.get_board_state()[game::BOARD_PLACED] & (start_index >> placement_index)) != 0)
-            {
-                // if there is a piece at fieldNum [placement_index].
-                continue;
-            }
+    uint32_t search::best_dag_edge(const mcts_dag& dag, const uint32_t node, const int side)
+    {
+        const auto& parent = dag[node];
+        assert(parent.edge_count > 0);
 
-            game_state.do_move(placement_index);
+        const auto exploration = 1.414 * sqrt(log(parent.n_visits()));
+        auto best = -INFINITY;
+        auto best_edge = parent.first_edge;
 
-            if (game_state.is_quarto())
+        for (auto e = parent.first_edge; e < parent.first_edge + parent.edge_count; ++e)
+        {
+            const auto& edge = dag.edge(e);
+            const auto visits = edge.n.load(std::memory_order_relaxed);
+            const auto child = edge.child.load(std::memory_order_acquire);
+            if (visits == 0 || child == search_node::NO_NODE || dag[child].n_visits() == 0)
             {
-                best_value = 2;
-                game_state.undo();
-                goto EARLY_END;
+                return e;
             }
 
-            if (game_state.is_game_over())
+            // the value is the one of the position, whichever edge its visits came through, the exploration only
+            // counts the visits of this edge
+            const auto& position = dag[child];
+            const auto value = side * position.t.load(std::memory_order_relaxed) / static_cast<double>(
+                position.n_visits());
+            if (const auto score = value + exploration / sqrt(visits); best < score)
             {
-                best_value = std::max(best_value, 0);
-                game_state.undo();
-                continue;
+                best = score;
+                best_edge = e;
             }
-
-            game_state.undo();
         }
 
-        // non leaf node
+        return best_edge;
+    }
 
-        for (char placement_index = 0; placement_index < 16; ++placement_index)
+    void search::traverse_dag(mcts_dag& dag, const uint32_t root, dag_path& path)
+    {
+        const auto loss = virtual_loss.load(std::memory_order_relaxed);
+        path.length = 0;
+        path.positions[0] = root;
+        // nobody picks the root, its loss is one for the player to move there
+        dag[root].add_virtual_loss(loss, 1);
+
+        // the player to move at the root picks at even depths
+        for (int side = 1;; side = -side)
         {
-            constexpr int start_index{0x8000};
-            if ((game_state.get_board_state()[game::BOARD_PLACED] & (start_index >> placement_index)) != 0)
-            {
-                // if there is a piece at fieldNum [placement_index].
-                continue;
-            }
-
-            game_state.do_move(placement_index);
+            const auto current = path.positions[path.length];
+            auto& node = dag[current];
 
-            for (char selection_index = 0; selection_index < 16; ++selection_index)
+            if (!node.is_expanded())
             {
-                if ((game_state.get_selection_state() & (start_index >> selection_index)) == 0)
+                // another thread expanding the position plays out from it meanwhile
+                if (!node.begin_expansion())
                 {
-                    // if there is no selection piece at index [selection_index].
-                    continue;
+                    return;
                 }
+                expand_dag(dag, current);
+            }
 
-                game_state.do_select(selection_index);
-                const auto score = min(game_state, alpha, beta, depth - 1);
-                game_state.undo();
-                if (score > best_value)
-                {
-                    best_value = score;
-                    if (score > alpha)
-                        alpha = score; // alpha acts like max in MiniMax
-                }
-                if (score >= beta)
-                {
-                    best_value = score;
-                    game_state.undo();
-                    goto EARLY_END;
-                }
+            // terminal position or no room left
+            if (node.edge_count == 0)
+            {
+                return;
             }
-            game_state.undo();
-        }
 
-    EARLY_END:
+            const auto unvisited = node.take_unvisited_edge();
+            const auto picked = unvisited != search_node::NO_NODE ? unvisited : best_dag_edge(dag, current, side);
+            auto& edge = dag.edge(picked);
 
-        assert(best_value != -100);
-        assert(best_value != 100);
+            auto child = edge.child.load(std::memory_order_acquire);
+            if (child == search_node::NO_NODE)
+            {
+                child = dag.find_or_insert(node.state.with_move(edge.move >> 4).with_select(edge.move & 0xf));
+                // the table is full, play out from here
+                if (child == search_node::NO_NODE)
+                {
+                    return;
+                }
+                edge.child.store(child, std::memory_order_release);
+            }
 
-        saved_states::get_instance()->store_eval(canonized, game_state.get_selection_piece(), best_value);
+            edge.n.fetch_add(1, std::memory_order_relaxed);
+            path.edges[path.length] = picked;
+            path.positions[++path.length] = child;
 
-        return best_value;
+            // a position no playout got to before, through any edge, is the leaf
+            if (dag[child].add_virtual_loss(loss, side) == 0)
+            {
+                return;
+            }
+        }
     }
 
-    int search::min(game& game_state, const int alpha, int beta, const int depth)
+    void search::backpropagate_dag(mcts_dag& dag, const dag_path& path, const playout_counts& counts)
     {
-        const auto canonized = game_state.canonize();
-        auto best_value = 1000;
-
-        // leafnode
+        // traverse already counted one visit
+        const auto loss = virtual_loss.load(std::memory_order_relaxed);
+        const auto score = counts.score();
+        const auto games = counts.games();
 
-        if (game_state.is_quarto())
+        for (int i = 0; i <= path.length; ++i)
         {
-            best_value = 2;
-            goto EARLY_END;
+            // the side that picked the position, as traverse_dag counted its loss
+            dag[path.positions[i]].add_result(score, games, loss, i == 0 || i % 2 == 1 ? 1 : -1);
         }
 
-        if (game_state.is_game_over())
+        if (games > 1)
         {
-            best_value = 0;
-            goto EARLY_END;
+            for (int i = 0; i < path.length; ++i)
+            {
+                dag.edge(path.edges[i]).n.fetch_add(games - 1, std::memory_order_relaxed);
+            }
         }
+    }
 
-        if (depth == 0)
-        {
-            best_value = 0;
-            goto EARLY_END;
-        }
+    uint8_t search::search_dag(game& game_state, const int search_time)
+    {
+        const auto start = std::chrono::high_resolution_clock::now();
+        mcts_dag dag;
+        // the table is empty, so the root keeps the orientation of game_state and its moves can be played as they are
+        const auto root = dag.find_or_insert(game_state.get_position());
+        dag[root].begin_expansion();
+        expand_dag(dag, root);
+        assert(dag[root].edge_count > 0);
 
-        if (saved_states::get_instance()->has_key(canonized, game_state.get_selection_piece()))
-        {
-            return saved_states::get_instance()->get_value(canonized, game_state.get_selection_piece());
-        }
+        std::atomic<uint64_t> count = 0;
 
-        // non leaf node
+        task_group search_tasks;
+        auto& pool = thread_pool::get_instance();
+        const auto requested = mcts_threads.load(std::memory_order_relaxed);
+        const auto thread_count = requested == 0 ? pool.get_thread_count() : std::min(requested, pool.get_thread_count());
 
-        for (char placement_index = 0; placement_index < 16; ++placement_index)
+        for (size_t i = 0; i < thread_count; ++i)
         {
-            constexpr int start_index{0x8000};
-            if ((game_state.get_board_state()[game::BOARD_PLACED] & (start_index >> placement_index)) != 0)
+            search_tasks.run([search_time, &dag, root, start, &count]
             {
-                // if there is a piece at fieldNum [placement_index].
-                continue;
-            }
+                const auto per_leaf = playouts_per_leaf.load(std::memory_order_relaxed);
+                uint64_t thread_playouts = 0;
+                dag_path path;
+                while (std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::high_resolution_clock::now() - start).count() <= search_time)
+                {
+                    thread_playouts += per_leaf;
 
-            game_state.do_move(placement_index);
+                    traverse_dag(dag, root, path);
+                    const auto& leaf = dag[path.positions[path.length]];
+                    const auto side = path.length % 2 == 0 ? 1 : -1;
+                    backpropagate_dag(dag, path, playout_batch(leaf.state, side, per_leaf, playout_rng));
+                }
 
-            if (game_state.is_quarto())
-            {
-                best_value = -2;
-                game_state.undo();
-                goto EARLY_END;
-            }
+                count.fetch_add(thread_playouts, std::memory_order_relaxed);
+            });
+        }
 
-            if (game_state.is_game_over())
+        search_tasks.wait();
+        playouts.fetch_add(count, std::memory_order_relaxed);
+
+        std::cout << count << " total visits: " << dag[root].n_visits() << " positions: " << dag.get_size() << std::endl;
+
+        const auto& node = dag[root];
+        auto best_edge = node.first_edge;
+        for (auto e = node.first_edge + 1; e < node.first_edge + node.edge_count; ++e)
+        {
+            if (dag.edge(e).n.load(std::memory_order_relaxed) > dag.edge(best_edge).n.load(std::memory_order_relaxed))
             {
-                best_value = std::min(best_value, 0);
-                game_state.undo();
-                continue;
+                best_edge = e;
             }
-
-            game_state.undo();
         }
 
+        return dag.edge(best_edge).move;
+    }
 
-        for (char placement_index = 0; placement_index < 16; ++placement_index)
+    uint8_t search::selective_search(game& game_state, const int time_remaining)
+    {
+        if (std::popcount(game_state.get_board_state()[game::BOARD_PLACED]) >= MINIMAX_MIN_PLACED)
         {
-            constexpr int start_index{0x8000};
-            if ((game_state.get_board_state()[game::BOARD_PLACED] & (start_index >> placement_index)) != 0)
-            {
-                // if there is a piece at fieldNum [placement_index].
-                continue;
-            }
+            // monte carlo is done for this game
+            mcts_session::get_instance().clear();
+#ifdef LAZY_SMP_SEARCH
+            return search_lazy_smp(game_state, thread_pool::get_instance().get_thread_count(), time_remaining);
+#else
+            return search_iterative(game_state, time_remaining);
+#endif
+        }
 
-            game_state.do_move(placement_index);
+        if (mcts_transpositions.load(std::memory_order_relaxed))
+        {
+            return search_dag(game_state, time_remaining);
+        }
 
-            for (char selection_index = 0; selection_index < 16; ++selection_index)
+        return mcts_session::get_instance().search(game_state, time_remaining);
+    }
+
+    uint8_t format_move(const uint8_t placement_move, const uint8_t selection_move)
+    {
+        return (placement_move << 4) | selection_move;
+    }
+
+    /**
+     * @return the first legal move, played when every move hands over a poisoned piece and the position is lost anyway.
+     * The last piece has nothing to hand over, its move only has the placement.
+     */
+    uint8_t first_move(const game& game_state)
+    {
+        const auto selection_state = game_state.get_selection_state();
+
+        return format_move(std::countl_zero(game_state.get_empty_squares()),
+                           selection_state == 0 ? 0 : std::countl_zero(selection_state));
+    }
+
+    /**
+     * Depth a result is saved with, a search reaching past the last empty square saw the whole game so it stays valid
+     * for any deeper search of the same position
+     */
+    uint8_t saved_depth(const game& game_state, const int depth)
+    {
+        return static_cast<uint8_t>(std::min(depth, std::popcount(game_state.get_empty_squares())));
+    }
+
+    /**
+     * @return how a fail soft result of the (alpha, beta) window relates to the real value
+     */
+    uint8_t bound_type(const int value, const int alpha, const int beta)
+    {
+        if (value <= alpha)
+        {
+            return transposition_table::BOUND_UPPER;
+        }
+
+        if (value >= beta)
+        {
+            return transposition_table::BOUND_LOWER;
+        }
+
+        return transposition_table::BOUND_EXACT;
+    }
+
+    void search::set_split_min_empties(const int empties)
+    {
+        // a split node needs at least two moves
+        assert(empties >= 2);
+        split_min_empties = empties;
+    }
+
+    void search::set_move_ordering(const uint8_t heuristics)
+    {
+        move_ordering = heuristics;
+    }
+
+    void search::set_mcts_threads(const size_t thread_count)
+    {
+        mcts_threads = thread_count;
+    }
+
+    void search::set_virtual_loss(const int loss)
+    {
+        virtual_loss = loss;
+    }
+
+    void search::set_playouts_per_leaf(const int count)
+    {
+        assert(count > 0);
+        playouts_per_leaf = count;
+    }
+
+    void search::set_mcts_transpositions(const bool enabled)
+    {
+        mcts_transpositions = enabled;
+    }
+
+    void search::generate_ordered_moves(const game& game_state, move_list& moves, const uint16_t hash_move)
+    {
+        game_state.generate_safe_moves(moves);
+
+        const auto heuristics = move_ordering.load(std::memory_order_relaxed);
+        if (heuristics == 0)
+        {
+            return;
+        }
+
+        // the lazy smp helpers still differ in how they break ties
+        std::rotate(moves.moves, moves.moves + moves.size * move_order / 16, moves.moves + moves.size);
+
+        const auto ply = std::popcount(game_state.get_board_state()[game::BOARD_PLACED]);
+        uint64_t keys[MAX_MOVES];
+
+        for (uint8_t i = 0; i < moves.size; ++i)
+        {
+            const auto move = moves.moves[i];
+            uint64_t score = (heuristics & ORDER_HISTORY) != 0 ? history[ply & 1][move >> 4][move & 0xf] : 0;
+
+            if ((heuristics & ORDER_HASH_MOVE) != 0 && move == hash_move)
+            {
+                score = 1ull << 34;
+            }
+            else if ((heuristics & ORDER_KILLERS) != 0 && move + 1 == killers[ply][0])
+            {
+                score = 1ull << 33;
+            }
+            else if ((heuristics & ORDER_KILLERS) != 0 && move + 1 == killers[ply][1])
+            {
+                score = 1ull << 32;
+            }
+
+            // the index keeps equally scored moves in the order they were generated
+            keys[i] = score << 16 | static_cast<uint64_t>(0xff - i) << 8 | move;
+        }
+
+        std::sort(keys, keys + moves.size, std::greater<>());
+
+        for (uint8_t i = 0; i < moves.size; ++i)
+        {
+            moves.moves[i] = static_cast<uint8_t>(keys[i]);
+        }
+    }
+
+    void search::add_cutoff(const game& game_state, const uint8_t move, const int depth)
+    {
+        const auto ply = std::popcount(game_state.get_board_state()[game::BOARD_PLACED]);
+
+        if (killers[ply][0] != move + 1)
+        {
+            killers[ply][1] = killers[ply][0];
+            killers[ply][0] = move + 1;
+        }
+
+        // halved when it gets large so the scores stay below the killers
+        if ((history[ply & 1][move >> 4][move & 0xf] += depth * depth) >= 1u << 30)
+        {
+            for (auto& placement : history[ply & 1])
+            {
+                for (auto& score : placement)
+                {
+                    score /= 2;
+                }
+            }
+        }
+    }
+
+    int search::solve(game& game_state, const bool null_window)
+    {
+        const auto depth = std::popcount(game_state.get_empty_squares());
+
+        if (!null_window)
+        {
+            return max(game_state, -1000, 1000, depth, nullptr);
+        }
+
+        // fail soft, a win search failing below 0 already proves the loss
+        if (const auto win = max(game_state, 0, 1, depth, nullptr); win != 0)
+        {
+            return win > 0 ? 2 : -2;
+        }
+
+        return max(game_state, -1, 0, depth, nullptr) >= 0 ? 0 : -2;
+    }
+
+    int search::max(game& game_state, int alpha, int beta, const int depth, const split_point* split)
+    {
+        // leafnode
+
+        if (game_state.is_quarto())
+        {
+            return -2;
+        }
+
+        if (game_state.is_game_over() || depth == 0)
+        {
+            return 0;
+        }
+
+        if (split_point::is_cut_off(split))
+        {
+            return 0;
+        }
+
+        ++nodes;
+
+        uint8_t selection;
+        const auto canonized = game_state.canonize_with_selection(selection);
+        const int original_alpha = alpha;
+        const auto search_depth = saved_depth(game_state, depth);
+        auto best_value = -1000;
+        uint16_t best_move = transposition_table::NO_MOVE;
+        uint16_t hash_move = transposition_table::NO_MOVE;
+
+        if (transposition_table::entry saved{}; saved_states::get_instance()->probe(canonized, selection, saved))
+        {
+            hash_move = saved.best_move;
+
+            if (saved.depth >= search_depth)
+            {
+                if (saved.bound == transposition_table::BOUND_EXACT)
+                {
+                    return saved.value;
+                }
+
+                if (saved.bound == transposition_table::BOUND_LOWER)
+                {
+                    alpha = std::max(alpha, static_cast<int>(saved.value));
+                }
+                else
+                {
+                    beta = std::min(beta, static_cast<int>(saved.value));
+                }
+
+                if (alpha >= beta)
+                {
+                    return saved.value;
+                }
+            }
+        }
+
+        if (game_state.winning_squares(game_state.get_selection_piece()) != 0)
+        {
+            saved_states::get_instance()->store_eval(canonized, selection, 2, transposition_table::FULL_DEPTH,
+                                                     transposition_table::BOUND_EXACT);
+            return 2;
+        }
+
+        if (game_state.get_selection_state() == 0)
+        {
+            // the last piece goes on the last square
+            best_value = std::max(best_value, 0);
+        }
+
+        // non leaf node
+
+        const auto order = move_order;
+
+        if (!lazy_helper
+            && std::popcount(game_state.get_empty_squares()) >= split_min_empties.load(std::memory_order_relaxed))
+        {
+            best_value = split_max(game_state, alpha, beta, depth, split, hash_move);
+
+            if (split_point::is_cut_off(split))
+            {
+                return 0;
+            }
+
+            goto EARLY_END;
+        }
+
+        if (move_ordering.load(std::memory_order_relaxed) != 0)
+        {
+            move_list moves;
+            generate_ordered_moves(game_state, moves, hash_move);
+
+            if (moves.empty() && game_state.get_selection_state() != 0)
+            {
+                // min completes a line with any piece we hand over
+                best_value = std::max(best_value, -2);
+            }
+
+            for (const auto move : moves)
+            {
+                game_state.do_move(move >> 4);
+                game_state.do_select(move & 0xf);
+                const auto score = min(game_state, alpha, beta, depth - 1, split);
+                game_state.undo();
+                game_state.undo();
+                if (split_point::is_cut_off(split))
+                {
+                    return 0;
+                }
+                if (score > best_value)
+                {
+                    best_value = score;
+                    best_move = move;
+                    if (score > alpha)
+                        alpha = score;
+                }
+                if (score >= beta)
+                {
+                    add_cutoff(game_state, move, depth);
+                    goto EARLY_END;
+                }
+            }
+
+            goto EARLY_END;
+        }
+
+        for (uint16_t empty_squares = std::rotl(game_state.get_empty_squares(), order); empty_squares != 0;)
+        {
+            const uint8_t placement_index = (pop_square(empty_squares) + order) & 0xf;
+            game_state.do_move(placement_index);
+
+            const auto pieces_left = game_state.get_selection_state();
+            const uint16_t safe_pieces = pieces_left & ~game_state.poisoned_pieces();
+
+            if (safe_pieces == 0 && pieces_left != 0)
+            {
+                // min completes a line with any piece we hand over
+                game_state.undo();
+                best_value = std::max(best_value, -2);
+                if (best_value >= beta)
+                {
+                    goto EARLY_END;
+                }
+                continue;
+            }
+
+            for (uint16_t pieces = std::rotl(safe_pieces, order); pieces != 0;)
+            {
+                const uint8_t selection_index = (pop_square(pieces) + order) & 0xf;
+                game_state.do_select(selection_index);
+                const auto score = min(game_state, alpha, beta, depth - 1, split);
+                game_state.undo();
+                if (split_point::is_cut_off(split))
+                {
+                    // the result is thrown away above, so nothing is stored either
+                    game_state.undo();
+                    return 0;
+                }
+                if (score > best_value)
+                {
+                    best_value = score;
+                    best_move = format_move(placement_index, selection_index);
+                    if (score > alpha)
+                        alpha = score; // alpha acts like max in MiniMax
+                }
+                if (score >= beta)
+                {
+                    best_value = score;
+                    game_state.undo();
+                    goto EARLY_END;
+                }
+            }
+            game_state.undo();
+        }
+
+    EARLY_END:
+
+        assert(best_value != -100);
+        assert(best_value != 100);
+
+        // a fail low says nothing about which move is best
+        saved_states::get_instance()->store_eval(canonized, selection, best_value, search_depth,
+                                                 bound_type(best_value, original_alpha, beta),
+                                                 best_value > original_alpha ? best_move : transposition_table::NO_MOVE);
+
+        return best_value;
+    }
+
+    int search::min(game& game_state, int alpha, int beta, const int depth, const split_point* split)
+    {
+        // leafnode
+
+        if (game_state.is_quarto())
+        {
+            return 2;
+        }
+
+        if (game_state.is_game_over() || depth == 0)
+        {
+            return 0;
+        }
+
+        if (split_point::is_cut_off(split))
+        {
+            return 0;
+        }
+
+        ++nodes;
+
+        // the table is from the point of view of the player to move, here that is min so the values are negated
+        uint8_t selection;
+        const auto canonized = game_state.canonize_with_selection(selection);
+        const int original_beta = beta;
+        const auto search_depth = saved_depth(game_state, depth);
+        auto best_value = 1000;
+        uint16_t best_move = transposition_table::NO_MOVE;
+        uint16_t hash_move = transposition_table::NO_MOVE;
+
+        if (transposition_table::entry saved{}; saved_states::get_instance()->probe(canonized, selection, saved))
+        {
+            hash_move = saved.best_move;
+
+            if (saved.depth >= search_depth)
+            {
+                if (saved.bound == transposition_table::BOUND_EXACT)
+                {
+                    return -saved.value;
+                }
+
+                if (saved.bound == transposition_table::BOUND_LOWER)
+                {
+                    beta = std::min(beta, -saved.value);
+                }
+                else
+                {
+                    alpha = std::max(alpha, -saved.value);
+                }
+
+                if (alpha >= beta)
+                {
+                    return -saved.value;
+                }
+            }
+        }
+
+        // non leaf node
+
+        if (game_state.winning_squares(game_state.get_selection_piece()) != 0)
+        {
+            saved_states::get_instance()->store_eval(canonized, selection, 2, transposition_table::FULL_DEPTH,
+                                                     transposition_table::BOUND_EXACT);
+            return -2;
+        }
+
+        if (game_state.get_selection_state() == 0)
+        {
+            // the last piece goes on the last square
+            best_value = std::min(best_value, 0);
+        }
+
+        const auto order = move_order;
+
+        if (!lazy_helper
+            && std::popcount(game_state.get_empty_squares()) >= split_min_empties.load(std::memory_order_relaxed))
+        {
+            best_value = split_min(game_state, alpha, beta, depth, split, hash_move);
+
+            if (split_point::is_cut_off(split))
+            {
+                return 0;
+            }
+
+            goto EARLY_END;
+        }
+
+        if (move_ordering.load(std::memory_order_relaxed) != 0)
+        {
+            move_list moves;
+            generate_ordered_moves(game_state, moves, hash_move);
+
+            if (moves.empty() && game_state.get_selection_state() != 0)
+            {
+                // max completes a line with any piece min hands over
+                best_value = std::min(best_value, 2);
+            }
+
+            for (const auto move : moves)
+            {
+                game_state.do_move(move >> 4);
+                game_state.do_select(move & 0xf);
+                const auto score = max(game_state, alpha, beta, depth - 1, split);
+                game_state.undo();
+                game_state.undo();
+                if (split_point::is_cut_off(split))
+                {
+                    return 0;
+                }
+                if (score < best_value)
+                {
+                    best_value = score;
+                    best_move = move;
+                    if (score < beta)
+                        beta = score;
+                }
+                if (score <= alpha)
+                {
+                    add_cutoff(game_state, move, depth);
+                    goto EARLY_END;
+                }
+            }
+
+            goto EARLY_END;
+        }
+
+        for (uint16_t empty_squares = std::rotl(game_state.get_empty_squares(), order); empty_squares != 0;)
+        {
+            const uint8_t placement_index = (pop_square(empty_squares) + order) & 0xf;
+            game_state.do_move(placement_index);
+
+            const auto pieces_left = game_state.get_selection_state();
+            const uint16_t safe_pieces = pieces_left & ~game_state.poisoned_pieces();
+
+            if (safe_pieces == 0 && pieces_left != 0)
             {
-                if ((game_state.get_selection_state() & (start_index >> selection_index)) == 0)
+                // max completes a line with any piece min hands over
+                game_state.undo();
+                best_value = std::min(best_value, 2);
+                if (best_value <= alpha)
                 {
-                    // if there is no selection piece at index [selection_index].
-                    continue;
+                    goto EARLY_END;
                 }
+                continue;
+            }
 
+            for (uint16_t pieces = std::rotl(safe_pieces, order); pieces != 0;)
+            {
+                const uint8_t selection_index = (pop_square(pieces) + order) & 0xf;
                 game_state.do_select(selection_index);
-                const auto score = max(game_state, alpha, beta, depth - 1);
+                const auto score = max(game_state, alpha, beta, depth - 1, split);
                 game_state.undo();
+                if (split_point::is_cut_off(split))
+                {
+                    game_state.undo();
+                    return 0;
+                }
                 if (score < best_value)
                 {
                     best_value = score;
+                    best_move = format_move(placement_index, selection_index);
                     if (score < beta)
                         beta = score; // beta acts like min in MiniMax
                 }
@@ -530,123 +1272,428 @@ namespace quarto
         assert(best_value != -100);
         assert(best_value != 100);
 
-        saved_states::get_instance()->store_eval(canonized, game_state.get_selection_piece(), best_value);
+        saved_states::get_instance()->store_eval(canonized, selection, -best_value, search_depth,
+                                                 bound_type(-best_value, -original_beta, -alpha),
+                                                 best_value < original_beta ? best_move : transposition_table::NO_MOVE);
 
         return best_value;
     }
 
+    /**
+     * Searches the moves of a max node the young brothers wait way: the first move alone, then every other move as a
+     * task that starts from the best value found so far. A move reaching beta cuts off the tasks still running.
+     *
+     * @return the fail soft value of the node, meaningless if a split point above was cut off
+     */
+    int search::split_max(game& game_state, const int alpha, const int beta, const int depth, const split_point* split,
+                          const uint16_t hash_move)
+    {
+        move_list moves;
+        generate_ordered_moves(game_state, moves, hash_move);
+
+        if (moves.empty())
+        {
+            // a split node has pieces left, so every move hands over a poisoned one
+            return -2;
+        }
+
+        game_state.do_move(moves.moves[0] >> 4);
+        game_state.do_select(moves.moves[0] & 0xf);
+        const auto first = min(game_state, alpha, beta, depth - 1, split);
+        game_state.undo();
+        game_state.undo();
+
+        if (first >= beta || split_point::is_cut_off(split))
+        {
+            return first;
+        }
+
+        split_point node{split, first};
+        task_group brothers;
+
+        for (uint8_t i = 1; i < moves.size; ++i)
+        {
+            brothers.run([&node, alpha, beta, depth, move = moves.moves[i], cloned = game_state.clone()]() mutable
+            {
+                if (split_point::is_cut_off(&node))
+                {
+                    return;
+                }
+
+                cloned.do_move(move >> 4);
+                cloned.do_select(move & 0xf);
+                const auto score = min(cloned, std::max(alpha, node.best.load()), beta, depth - 1, &node);
+                // pool workers keep their solved positions until flushed, like the root tasks
+                saved_states::get_instance()->flush_log();
+
+                if (split_point::is_cut_off(&node))
+                {
+                    return;
+                }
+
+                for (auto best = node.best.load(); score > best && !node.best.compare_exchange_weak(best, score);)
+                {
+                }
+
+                if (score >= beta)
+                {
+                    node.cutoff = true;
+                }
+            });
+        }
+
+        brothers.wait();
 
-    void search::minimax_thread(const uint8_t move, std::unordered_map<uint8_t, int>& eval_map,
-                                const std::shared_ptr<game>& game)
+        return node.best;
+    }
+
+    /**
+     * split_max for min nodes, the shared best value lowers the beta of the moves started later
+     */
+    int search::split_min(game& game_state, const int alpha, const int beta, const int depth, const split_point* split,
+                          const uint16_t hash_move)
     {
-        const auto score = -max(*game);
-        this->eval_mutex.lock();
+        move_list moves;
+        generate_ordered_moves(game_state, moves, hash_move);
+
+        if (moves.empty())
+        {
+            return 2;
+        }
+
+        game_state.do_move(moves.moves[0] >> 4);
+        game_state.do_select(moves.moves[0] & 0xf);
+        const auto first = max(game_state, alpha, beta, depth - 1, split);
+        game_state.undo();
+        game_state.undo();
+
+        if (first <= alpha || split_point::is_cut_off(split))
+        {
+            return first;
+        }
+
+        split_point node{split, first};
+        task_group brothers;
+
+        for (uint8_t i = 1; i < moves.size; ++i)
+        {
+            brothers.run([&node, alpha, beta, depth, move = moves.moves[i], cloned = game_state.clone()]() mutable
+            {
+                if (split_point::is_cut_off(&node))
+                {
+                    return;
+                }
 
-        assert(eval_map.count(move) == 0);
+                cloned.do_move(move >> 4);
+                cloned.do_select(move & 0xf);
+                const auto score = max(cloned, alpha, std::min(beta, node.best.load()), depth - 1, &node);
+                // pool workers keep their solved positions until flushed, like the root tasks
+                saved_states::get_instance()->flush_log();
 
-        eval_map[move] = score;
+                if (split_point::is_cut_off(&node))
+                {
+                    return;
+                }
 
-        this->eval_mutex.unlock();
+                for (auto best = node.best.load(); score < best && !node.best.compare_exchange_weak(best, score);)
+                {
+                }
+
+                if (score <= alpha)
+                {
+                    node.cutoff = true;
+                }
+            });
+        }
+
+        brothers.wait();
+
+        return node.best;
+    }
+
+    void search::minimax_thread(const uint8_t move, game& game_state, split_point& root, uint8_t& best_move,
+                                const int depth)
+    {
+        // searched with the best root value so far as alpha, a move that can't beat it only has to be refuted
+        const auto score = -max(game_state, -1000, -root.best.load(), depth - 1, &root);
+
+        if (split_point::is_cut_off(&root))
+        {
+            return;
+        }
+
+        std::lock_guard lock(this->eval_mutex);
+
+        // a fail soft bound is never above the alpha it was searched with, so only exact values get here
+        if (score > root.best)
+        {
+            root.best = score;
+            best_move = move;
+
+            if (score >= 2)
+            {
+                // nothing beats a win, the other root moves don't have to finish
+                root.cutoff = true;
+            }
+        }
     }
 
-    uint8_t search::search_dfs(const std::shared_ptr<game>& game_state)
+    bool search::search_root(game& game_state, const int depth, split_point* stop,
+                             const std::chrono::steady_clock::time_point deadline, int& value, uint8_t& move)
     {
-        const auto bitboards = game_state->get_board_state();
-        const auto piece_bitboard = bitboards[game::BOARD_PLACED];
-        const auto selection_board = game_state->get_selection_state();
-        auto max = -1000;
+        // every (placement, selection) pair is its own task so the pool can balance them, they all share the best
+        // value of the root
+        // no task searches the last placement, it has no piece to hand over
+        if (game_state.get_selection_state() == 0)
+        {
+            value = game_state.winning_squares(game_state.get_selection_piece()) != 0 ? 2 : 0;
+            move = first_move(game_state);
+            return true;
+        }
 
-        std::vector<std::thread> search_threads;
-        std::unordered_map<uint8_t, int> evals;
+        split_point root{stop, -1000};
+        uint8_t root_best_move = move;
+        int task_count = 0;
 
-        std::cout << "Size: " << saved_states::get_instance()->get_size() << std::endl;
+        // moves leading to the same canonical position are only searched once
+        move_list moves;
+        game_state.generate_safe_moves(moves);
+        game_state.remove_transposed_moves(moves);
 
-        uint8_t move = 0;
+        // the best move so far goes first, with the pool busy it is likely the one that sets the root bound
+        if (const auto previous = std::find(moves.moves, moves.moves + moves.size, move);
+            previous != moves.moves + moves.size)
+        {
+            std::rotate(moves.moves, previous, previous + 1);
+        }
 
-        for (uint8_t placement_index = 0; placement_index < 16; ++placement_index)
         {
-            constexpr int start_index{0x8000};
-            if ((piece_bitboard & (start_index >> placement_index)) != 0)
+            task_group root_moves;
+
+            for (const auto root_move : moves)
             {
-                // if there is a piece at fieldNum [placement_index].
-                continue;
+                game_state.do_move(root_move >> 4);
+                game_state.do_select(root_move & 0xf);
+
+                root_moves.run([this, &root, &root_best_move, root_move, depth, cloned = game_state.clone()]() mutable
+                {
+                    minimax_thread(root_move, cloned, root, root_best_move, depth);
+                    saved_states::get_instance()->flush_log();
+                });
+                ++task_count;
+
+                game_state.undo();
+                game_state.undo();
             }
 
-            game_state->do_move(placement_index);
+            std::cout << "all tasks started: " << task_count << std::endl;
 
-            if (game_state->is_quarto())
+            if (stop != nullptr && !root_moves.wait_until(deadline))
             {
-                move = format_move(placement_index, 0);
-                std::cout << "SHOULD WIN! Placement: " << int(placement_index) << " selected move: " << int(move) <<
-                    std::endl;
-                game_state->print_state();
-                std::cout << "SHOULD WIN!" << std::endl;
-                game_state->undo();
-                goto EARLY_EXIT;
+                // the running tasks see the cutoff and return, the group waits for them when it goes out of scope
+                stop->cutoff = true;
+                return false;
             }
+        }
+
+        if (task_count == 0)
+        {
+            value = -2;
+            move = first_move(game_state);
+            return true;
+        }
+
+        value = root.best;
+        move = root_best_move;
+        return true;
+    }
+
+    uint8_t search::search_iterative(game& game_state, const int search_time)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + std::chrono::milliseconds(search_time);
 
-            game_state->undo();
+        saved_states::get_instance()->new_search();
+
+        if (const auto winning_squares = game_state.winning_squares(game_state.get_selection_piece());
+            winning_squares != 0)
+        {
+            return format_move(std::countl_zero(winning_squares), 0);
         }
 
-        for (uint8_t placement_index = 0; placement_index < 16; ++placement_index)
+        const auto empties = std::popcount(game_state.get_empty_squares());
+
+        // a move to play even if not a single iteration finishes, the safe moves come first
+        move_list moves;
+        game_state.generate_safe_moves(moves);
+        uint8_t move = moves.empty() ? first_move(game_state) : moves.moves[0];
+
+        // stays cut off once the deadline passed, every search below it returns at once and stores nothing
+        split_point stop{nullptr, 0};
+
+        // the table keeps the results of every iteration, each deeper one starts from their bounds and best moves
+        for (int depth = 1; depth <= empties; ++depth)
         {
-            constexpr int start_index{0x8000};
-            if ((piece_bitboard & (start_index >> placement_index)) != 0)
+            int value;
+            uint8_t iteration_move = move;
+
+            if (!search_root(game_state, depth, &stop, deadline, value, iteration_move))
             {
-                continue;
+                std::cout << "depth " << depth << " ran out of time" << std::endl;
+                break;
             }
 
-            game_state->do_move(placement_index);
+            move = iteration_move;
+            std::cout << "depth " << depth << ": " << value << " move: " << int(move) << " after "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).
+                count() << " ms" << std::endl;
 
-            auto cloned = game_state->clone();
+            // leaves past the depth count as draws, so a win or loss is already the real value
+            if (value == 2 || value == -2)
+            {
+                break;
+            }
+        }
+
+        saved_states::get_instance()->flush_log();
 
-            search_threads.emplace_back([this, &evals, placement_index, cloned, selection_board]()
+        return move;
+    }
+
+    int search::lazy_smp_thread(game& game_state, const split_point& finished, uint8_t& best_move)
+    {
+        const auto order = move_order;
+        auto best = -1000;
+
+        for (uint16_t empty_squares = std::rotl(game_state.get_empty_squares(), order); empty_squares != 0;)
+        {
+            const uint8_t placement_index = (pop_square(empty_squares) + order) & 0xf;
+            game_state.do_move(placement_index);
+
+            const uint16_t safe_pieces = game_state.get_selection_state() & ~game_state.poisoned_pieces();
+
+            for (uint16_t pieces = std::rotl(safe_pieces, order); pieces != 0;)
             {
-                for (uint8_t selection_index = 0; selection_index < 16; ++selection_index)
-                {
-                    if ((selection_board & (start_index >> selection_index)) == 0)
-                    {
-                        continue;
-                    }
+                const uint8_t selection_index = (pop_square(pieces) + order) & 0xf;
+                game_state.do_select(selection_index);
+                const auto score = -max(game_state, -1000, -best, std::popcount(game_state.get_empty_squares()),
+                                         &finished);
+                game_state.undo();
 
-                    cloned->do_select(selection_index);
+                if (split_point::is_cut_off(&finished))
+                {
+                    game_state.undo();
+                    return best;
+                }
 
-                    minimax_thread(format_move(placement_index, selection_index), evals, cloned);
+                if (score > best)
+                {
+                    best = score;
+                    best_move = format_move(placement_index, selection_index);
+                }
 
-                    cloned->undo();
+                if (best >= 2)
+                {
+                    game_state.undo();
+                    return best;
                 }
-            });
+            }
 
-            game_state->undo();
+            game_state.undo();
         }
 
-        std::cout << "all threads started: " << search_threads.size() << std::endl;
+        if (best == -1000 && game_state.get_selection_state() != 0)
+        {
+            best = -2;
+            best_move = first_move(game_state);
+        }
 
-        for (auto& t : search_threads)
+        return best;
+    }
+
+    uint8_t search::search_lazy_smp(game& game_state, const size_t thread_count, const int search_time)
+    {
+        assert(thread_count > 0);
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(search_time);
+
+        saved_states::get_instance()->new_search();
+
+        if (const auto winning_squares = game_state.winning_squares(game_state.get_selection_piece());
+            winning_squares != 0)
         {
-            if (t.joinable())
-            {
-                t.join();
-            }
+            return format_move(std::countl_zero(winning_squares), 0);
+        }
+
+        // the helpers only search moves that hand over a piece, the last one has nothing to hand over
+        if (game_state.get_selection_state() == 0)
+        {
+            return format_move(std::countl_zero(game_state.get_empty_squares()), 0);
         }
 
-        for (auto ev : evals)
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        // played if no helper finishes in time, the safe moves come first
+        move_list moves;
+        game_state.generate_safe_moves(moves);
+        uint8_t move = moves.empty() ? first_move(game_state) : moves.moves[0];
+
+        // cut off by the first helper to finish or at the deadline, the others throw away what they were doing
+        split_point finished{nullptr, -1000};
+        std::atomic<uint64_t> total_nodes = 0;
+
         {
-            if (max < ev.second)
+            task_group helpers;
+
+            for (size_t i = 0; i < thread_count; ++i)
             {
-                max = ev.second;
-                move = ev.first;
+                helpers.run([this, &finished, &total_nodes, &move, i, cloned = game_state.clone()]() mutable
+                {
+                    // 7 is odd, so the first 16 helpers all start from a different square and piece
+                    lazy_helper = true;
+                    move_order = static_cast<uint8_t>(i * 7 % 16);
+                    const auto start_nodes = nodes;
+
+                    uint8_t helper_move = 0;
+                    const auto value = lazy_smp_thread(cloned, finished, helper_move);
+                    // the helper runs on a pool worker, whose solved positions only the worker can flush
+                    saved_states::get_instance()->flush_log();
+
+                    total_nodes += nodes - start_nodes;
+                    lazy_helper = false;
+                    move_order = 0;
+
+                    std::lock_guard lock(this->eval_mutex);
+
+                    if (!split_point::is_cut_off(&finished))
+                    {
+                        finished.best = value;
+                        finished.cutoff = true;
+                        move = helper_move;
+                    }
+                });
             }
-        }
 
-        std::cout << "Max: " << max << std::endl;
+            if (!helpers.wait_until(deadline))
+            {
+                std::lock_guard lock(this->eval_mutex);
+
+                // a helper that finished just now still gives the move
+                if (!split_point::is_cut_off(&finished))
+                {
+                    finished.cutoff = true;
+                    std::cout << "lazy smp ran out of time" << std::endl;
+                }
+            }
+        }
 
-    EARLY_EXIT:
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
 
-        std::cout << "Size: " << saved_states::get_instance()->get_size() << std::endl;
+        std::cout << "Max: " << finished.best << " nodes: " << total_nodes << " nps: "
+            << total_nodes * 1000 / std::max<int64_t>(elapsed, 1) << std::endl;
 
-        saved_states::get_instance()->clear_zeroes();
-        // saved_states::get_instance()->save(DEFAULT_SAVE_FILENAME);
+        saved_states::get_instance()->flush_log();
 
         return move;
     }
@@ -2,152 +2,319 @@
 #define SHMINIMAXING_SEARCH_TREE_H
 
 #include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cassert>
-#include <shared_mutex>
-#include <unordered_map>
+#include <mutex>
 
 #include "game.h"
+#include "mcts_dag.h"
+#include "node_arena.h"
+#include "xoshiro.h"
+
+#define DEFAULT_SPLIT_MIN_EMPTIES 8
+// positions with at least this many pieces placed are searched with minimax instead of monte carlo
+#define MINIMAX_MIN_PLACED 6
+
+// score a monte carlo playout counts for while it is on its way, the same as search::LOSS_SCORE
+#define DEFAULT_VIRTUAL_LOSS 10
+// random games search_mnt plays from every leaf, from 1 to 64 they picked the best move about equally often on 6 and 7
+// piece positions at the same time per move
+#define DEFAULT_PLAYOUTS_PER_LEAF 16
+
+// move ordering heuristics for search::set_move_ordering
+#define ORDER_HASH_MOVE 0x1
+#define ORDER_KILLERS 0x2
+#define ORDER_HISTORY 0x4
+// the history heuristic searched more nodes than index order on the 7 piece solves of bench_solve
+#define DEFAULT_MOVE_ORDERING (ORDER_HASH_MOVE | ORDER_KILLERS)
 
 namespace quarto
 {
-    class search_node
+    /**
+     * A node whose moves after the first one are searched in parallel. best is the value of the node so far, the
+     * searches below it follow the parent pointers to find out if a split point above them was cut off, in which case
+     * their results are thrown away.
+     */
+    struct split_point
     {
-        std::atomic<int> t{0};
-        std::atomic<int> n{0};
-        bool visited = false;
+        const split_point* parent;
+        std::atomic<int> best;
+        std::atomic<bool> cutoff{false};
+
+        /**
+         * @return true if split or any split point above it was cut off
+         */
+        static bool is_cut_off(const split_point* split)
+        {
+            for (; split != nullptr; split = split->parent)
+            {
+                if (split->cutoff.load(std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
 
-        std::shared_ptr<search_node> parent = nullptr;
-        std::vector<std::shared_ptr<search_node>> children;
+            return false;
+        }
+    };
 
+    class search
+    {
     public:
-        std::mutex expansion_mtx;
-        uint8_t placement_move = INVALID_PIECE_SELECTION;
-        uint8_t selection_move = INVALID_PIECE_SELECTION;
+        /**
+         * @param side game::move_side at node, the scores are for the root player so the opponent picks by their negation
+         * @return the unsolved child with the highest uct, NO_NODE if all of them are solved
+         */
+        static uint32_t best_uct(const node_arena& arena, uint32_t node, int side);
 
-        search_node() = delete;
+        /**
+         * Walks down from root by uct and plays the moves on game_state, up to the first node that has a child without
+         * a playout, which it expands if needed. A node that is terminal, solved, or can't be expanded because the arena
+         * is full, is returned itself.
+         *
+         * @return the node to play out from
+         */
+        [[nodiscard]] static uint32_t traverse(node_arena& arena, uint32_t root, game& game_state);
 
-        explicit search_node(const std::shared_ptr<search_node>& node)
-        {
-            this->parent = node;
-        }
+        /**
+         * The moves monte carlo expands a position with: one move per winning square if the piece to place wins,
+         * otherwise the safe moves, or all moves if there are none, without the symmetric ones
+         *
+         * @return true if the piece to place wins
+         */
+        static bool generate_tree_moves(const game& game_state, move_list& moves);
 
-        search_node(const search_node& other)
-            : visited(other.visited),
-              parent(other.parent), children(other.children),
-              placement_move(other.placement_move),
-              selection_move(other.selection_move)
-        {
-        }
+        /**
+         * Allocates the children of node as one block, leaves the node unexpanded if the arena is full
+         */
+        static void populate_children(node_arena& arena, uint32_t node, game& game_state);
+        // scores of a finished game for the player to move at the root of search_mnt
+        constexpr static int WIN_SCORE{3};
+        constexpr static int LOSS_SCORE{-10};
+        constexpr static int DRAW_SCORE{1};
 
-        [[nodiscard]] std::shared_ptr<search_node> get_parent() const
+        /**
+         * Results of a batch of playouts from one position, for the player to move at the root of search_mnt
+         */
+        struct playout_counts
         {
-            return this->parent;
-        }
+            int wins = 0;
+            int draws = 0;
+            int losses = 0;
 
-        std::vector<std::shared_ptr<search_node>>& get_children()
-        {
-            return this->children;
-        }
+            [[nodiscard]] int games() const
+            {
+                return wins + draws + losses;
+            }
 
-        [[nodiscard]] bool is_expanded() const
-        {
-            for (const auto& c : this->children)
+            /**
+             * @return the sum of the eval scores of the games
+             */
+            [[nodiscard]] int score() const
             {
-                if (!c->is_visited())
-                {
-                    return false;
-                }
+                return wins * WIN_SCORE + draws * DRAW_SCORE + losses * LOSS_SCORE;
             }
+        };
 
-            return true;
-        }
+        [[nodiscard]] static int eval(const game& game_state);
 
-        [[nodiscard]] bool is_visited() const
-        {
-            return this->visited;
-        }
+        /**
+         * Plays random moves from state to the end of the game and takes a quarto whenever the piece to place allows
+         * one. Works on the bitboards and the line state alone, side is game::move_side of state.
+         *
+         * @return the eval score of the finished game
+         */
+        [[nodiscard]] static int playout(const position& state, int side, xoshiro256& rng);
 
-        void set_visited(const bool val)
-        {
-            this->visited = val;
-        }
+        /**
+         * count playouts from the same position, which is only prepared once
+         */
+        [[nodiscard]] static playout_counts playout_batch(const position& state, int side, int count, xoshiro256& rng);
 
-        [[nodiscard]] double get_t_score() const
-        {
-            return this->t;
-        }
+        /**
+         * count playouts from the current position of game_state with the generator of the calling thread
+         */
+        [[nodiscard]] static playout_counts rollout(const game& game_state, int count = 1);
 
-        void add_t_score(const int val)
-        {
-            this->t.fetch_add(val);
-        }
+        /**
+         * count games with the result a solved node was proven to have, game_state is at the node
+         */
+        [[nodiscard]] static playout_counts proven_result(const search_node& node, const game& game_state, int count);
 
-        void add_visits(const int visits)
-        {
-            this->n.fetch_add(visits);
-        }
+        /**
+         * Adds the results to node and everything above it as one update, the first playout was already counted as a
+         * visit by traverse. When node is solved, the nodes above it that this decides are solved as well.
+         */
+        static void backpropagate(node_arena& arena, uint32_t node, const playout_counts& counts);
+        /**
+         * @return the move of a child proven lost for the opponent if there is one, otherwise of the most visited child
+         * that is not proven won for them
+         */
+        static uint8_t best_child(const node_arena& arena, uint32_t node);
+
+        /**
+         * Monte carlo tree search on mcts_threads threads sharing one tree without locks. Positions won or lost by
+         * force are solved on the way, the search stops early when the root is.
+         */
+        static uint8_t search_mnt(game& game_state, int search_time);
+
+        /**
+         * search_mnt on a tree the caller keeps, root has to be expanded and game_state at the position of root
+         */
+        static uint8_t search_mnt(node_arena& arena, uint32_t root, game& game_state, int search_time);
+        /**
+         * Expands a position of an mcts_dag with the moves of generate_tree_moves, as a leaf if there is no room
+         */
+        static void expand_dag(mcts_dag& dag, uint32_t node);
+
+        /**
+         * best_uct for an mcts_dag: the value of an edge is the one of the position it leads to, the exploration term
+         * only counts the visits through the edge. An edge without visits comes first.
+         */
+        static uint32_t best_dag_edge(const mcts_dag& dag, uint32_t node, int side);
+
+        /**
+         * traverse for an mcts_dag. A position reached for the first time is the leaf, one that other playouts got to
+         * by another move order is walked through. Fills path with where it went.
+         */
+        static void traverse_dag(mcts_dag& dag, uint32_t root, dag_path& path);
 
-        [[nodiscard]] int n_visits() const
+        /**
+         * Adds the results to every position and edge of path
+         */
+        static void backpropagate_dag(mcts_dag& dag, const dag_path& path, const playout_counts& counts);
+
+        /**
+         * search_mnt on an mcts_dag: positions reached by other move orders or as a symmetry share their statistics.
+         * Doesn't solve positions like search_mnt does.
+         *
+         * @return the move of the root edge with the most visits
+         */
+        static uint8_t search_dag(game& game_state, int search_time);
+
+        /**
+         * Minimax over every root move on the pool, one move deeper every iteration until the position is solved or
+         * search_time milliseconds are over. An iteration that runs out of time is thrown away and the move of the last
+         * finished one is played.
+         */
+        uint8_t search_iterative(game& game_state, int search_time);
+
+        /**
+         * Solves the position with at most two null window searches sharing the transposition table, one asking if it
+         * is a win and one asking if it is at least a draw. With null_window false it does one full window search
+         * instead, to compare against.
+         *
+         * @return -2, 0 or 2 from the point of view of the player to place
+         */
+        static int solve(game& game_state, bool null_window = true);
+
+        /**
+         * @return the max and min nodes the calling thread searched so far
+         */
+        static uint64_t searched_nodes()
         {
-            return this->n;
+            return nodes;
         }
 
-        [[nodiscard]] uint8_t format() const
+        /**
+         * @return the playouts of every search_mnt so far
+         */
+        static uint64_t mcts_playouts()
         {
-            return (placement_move << 4) | selection_move;
+            return playouts.load(std::memory_order_relaxed);
         }
 
-        [[nodiscard]] std::shared_ptr<search_node> pick_unvisited_child() const
-        {
-            for (auto c : children)
-            {
-                if (!c->is_visited())
-                {
-                    return c;
-                }
-            }
+        /**
+         * Minimax without splitting the tree: thread_count helpers all solve the whole position, each with its moves
+         * in a different order, and only share the transposition table. The first helper to finish gives the move,
+         * if none does within search_time milliseconds a safe move is played.
+         */
+        uint8_t search_lazy_smp(game& game_state, size_t thread_count, int search_time);
+        uint8_t selective_search(game& game_state, int time_remaining);
 
-            return nullptr;
-        }
+        /**
+         * Nodes with at least this many empty squares search their moves after the first one in parallel, anything
+         * above 16 searches serially
+         */
+        static void set_split_min_empties(int empties);
 
-        [[nodiscard]] double get_uct(const double c_param) const
-        {
-            assert(parent != nullptr);
+        /**
+         * The ORDER_ heuristics max and min sort their moves with: the best move from the transposition table first,
+         * then the killer moves of the ply and then the rest by their history score. With none of them they go through
+         * the moves in index order.
+         */
+        static void set_move_ordering(uint8_t heuristics);
 
-            if (n.load() == 0)
-            {
-                return INFINITY;
-            }
+        /**
+         * Threads search_mnt runs playouts on, 0 (the default) is one per worker of the pool. Neither this nor the
+         * virtual loss should change while search_mnt runs.
+         */
+        static void set_mcts_threads(size_t thread_count);
+        static void set_virtual_loss(int loss);
 
-            return t.load() / static_cast<double>(n.load()) + c_param * sqrt(log(parent->n_visits()) / static_cast<double>(n.load()));
-        }
-    };
+        /**
+         * Playouts search_mnt runs from every leaf it reaches, more of them spread the cost of walking down the tree
+         * over more games
+         */
+        static void set_playouts_per_leaf(int count);
 
-    class search
-    {
-    public:
-        static std::shared_ptr<search_node> best_uct(const std::shared_ptr<search_node>& node);
-        [[nodiscard]] std::shared_ptr<search_node> static traverse(const std::shared_ptr<search_node>& root,
-                                                                   const std::shared_ptr<game>& game_state);
-        static void populate_children(const std::shared_ptr<search_node>& node,
-                                      const std::shared_ptr<game>& game_state);
-        [[nodiscard]] static int eval(const std::shared_ptr<game>& game_state);
-        [[nodiscard]] static int rollout(const std::shared_ptr<search_node>& node,
-                                         const std::shared_ptr<game>& game_state);
-        static void backpropagate(const std::shared_ptr<search_node>& node, int result);
-        static uint8_t best_child(const std::shared_ptr<search_node>& node);
-
-        static uint8_t search_mnt(const std::shared_ptr<game>& game, int search_time);
-        uint8_t search_dfs(const std::shared_ptr<game>& game_state);
-        uint8_t selective_search(const std::shared_ptr<game>& game_state, int time_remaining);
+        /**
+         * Makes selective_search run search_dag instead of keeping a tree between moves with mcts_session
+         */
+        static void set_mcts_transpositions(bool enabled);
 
     private:
-        std::shared_mutex eval_mutex;
-        void minimax_thread(uint8_t move, std::unordered_map<uint8_t, int>& eval_map, const std::shared_ptr<game>& game);
-        static int max(game& game_state);
-        static int max(game& game_state, int alpha, int beta, int depth);
-        static int min(game& game_state, int alpha, int beta, int depth);
+        inline static std::atomic<int> split_min_empties{DEFAULT_SPLIT_MIN_EMPTIES};
+        inline static std::atomic<size_t> mcts_threads{0};
+        inline static std::atomic<int> virtual_loss{DEFAULT_VIRTUAL_LOSS};
+        inline static std::atomic<int> playouts_per_leaf{DEFAULT_PLAYOUTS_PER_LEAF};
+        inline static std::atomic<bool> mcts_transpositions{false};
+        inline static std::atomic<uint64_t> playouts{0};
+        inline static std::atomic<uint64_t> playout_seeds{0};
+        inline static thread_local xoshiro256 playout_rng{playout_seeds.fetch_add(1, std::memory_order_relaxed)};
+
+        // set on lazy smp helpers, which never split and search the moves rotated by move_order
+        inline static thread_local bool lazy_helper = false;
+        inline static thread_local uint8_t move_order = 0;
+        // max and min nodes searched by the calling thread
+        inline static thread_local uint64_t nodes = 0;
+
+        inline static std::atomic<uint8_t> move_ordering{DEFAULT_MOVE_ORDERING};
+        // per thread, the last two moves that caused a cutoff for every number of placed pieces (stored plus one, 0 is
+        // none) and for both players how much every (placement, selection) pair caused cutoffs, weighted by the depth
+        // left
+        inline static thread_local uint16_t killers[17][2]{};
+        inline static thread_local uint32_t history[2][16][16]{};
+
+        /**
+         * generate_safe_moves, sorted best first by the move ordering heuristics
+         */
+        static void generate_ordered_moves(const game& game_state, move_list& moves, uint16_t hash_move);
+
+        /**
+         * Makes the move a killer of the ply and adds to its history score
+         */
+        static void add_cutoff(const game& game_state, uint8_t move, int depth);
+
+        std::mutex eval_mutex;
+        void minimax_thread(uint8_t move, game& game_state, split_point& root, uint8_t& best_move, int depth);
+
+        /**
+         * Searches every root move depth moves deep on the pool, under stop if given. move is searched first and set to
+         * the best move, value to its value. The last placement has only one move, which is not searched.
+         *
+         * @return false if the deadline passed first, stop is cut off then and value and move are left as they were
+         */
+        bool search_root(game& game_state, int depth, split_point* stop, std::chrono::steady_clock::time_point deadline,
+                         int& value, uint8_t& move);
+        static int lazy_smp_thread(game& game_state, const split_point& finished, uint8_t& best_move);
+        static int max(game& game_state, int alpha, int beta, int depth, const split_point* split);
+        static int min(game& game_state, int alpha, int beta, int depth, const split_point* split);
+        static int split_max(game& game_state, int alpha, int beta, int depth, const split_point* split,
+                             uint16_t hash_move);
+        static int split_min(game& game_state, int alpha, int beta, int depth, const split_point* split,
+                             uint16_t hash_move);
     };
 } // quarto
 
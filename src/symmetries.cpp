@@ -0,0 +1,169 @@
+#include "symmetries.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SHMINIMAXING_X86_KERNELS
+#endif
+
+namespace quarto::symmetries::board
+{
+    __uint128_t minimal_key_scalar(const uint16_t placed, const uint16_t candidates[][4], const int candidate_count)
+    {
+        // the placed bitboard is the same for every candidate, so only the symmetries giving its minimal image can
+        // give the minimal key
+        uint16_t min_placed = std::numeric_limits<uint16_t>::max();
+        uint32_t minimal_symmetries = 0;
+
+        for (int symmetry = 0; symmetry < SYMMETRY_COUNT; ++symmetry)
+        {
+            const auto placed_image = transform(symmetry, placed);
+
+            if (placed_image < min_placed)
+            {
+                min_placed = placed_image;
+                minimal_symmetries = 0;
+            }
+
+            if (placed_image == min_placed)
+            {
+                minimal_symmetries |= 1u << symmetry;
+            }
+        }
+
+        uint64_t min_attributes = std::numeric_limits<uint64_t>::max();
+
+        for (int candidate = 0; candidate < candidate_count; ++candidate)
+        {
+            for (uint32_t remaining = minimal_symmetries; remaining != 0; remaining &= remaining - 1)
+            {
+                const int symmetry = std::countr_zero(remaining);
+                uint64_t attributes = 0;
+
+                for (int i = 0; i < 4; ++i)
+                {
+                    attributes |= static_cast<uint64_t>(transform(symmetry, candidates[candidate][i])) << (16 * i);
+                }
+
+                min_attributes = std::min(min_attributes, attributes);
+            }
+        }
+
+        return static_cast<__uint128_t>(min_placed) << 64 | min_attributes;
+    }
+
+#ifdef SHMINIMAXING_X86_KERNELS
+    namespace
+    {
+        /**
+         * All 32 images of a bitboard, symmetries 0 to 15 in low and 16 to 31 in high
+         */
+        __attribute__((target("avx2"))) inline void all_images(const uint16_t mat, __m256i& low, __m256i& high)
+        {
+            low = _mm256_setzero_si256();
+            high = _mm256_setzero_si256();
+
+            for (int nibble = 0; nibble < 4; ++nibble)
+            {
+                const uint16_t* row = NIBBLE_TABLES.images[nibble][(mat >> (4 * nibble)) & 0xf];
+                low = _mm256_or_si256(low, _mm256_load_si256(reinterpret_cast<const __m256i*>(row)));
+                high = _mm256_or_si256(high, _mm256_load_si256(reinterpret_cast<const __m256i*>(row + 16)));
+            }
+        }
+
+        __attribute__((target("avx2"))) inline uint16_t horizontal_min(const __m256i low, const __m256i high)
+        {
+            const __m256i both = _mm256_min_epu16(low, high);
+            const __m128i half = _mm_min_epu16(_mm256_castsi256_si128(both), _mm256_extracti128_si256(both, 1));
+
+            return static_cast<uint16_t>(_mm_cvtsi128_si32(_mm_minpos_epu16(half)));
+        }
+    }
+
+    bool has_avx2_kernel()
+    {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+    __attribute__((target("avx2")))
+    __uint128_t minimal_key_avx2(const uint16_t placed, const uint16_t candidates[][4], const int candidate_count)
+    {
+        const __m256i all_ones = _mm256_set1_epi16(-1);
+
+        __m256i placed_low, placed_high;
+        all_images(placed, placed_low, placed_high);
+
+        const uint16_t min_placed = horizontal_min(placed_low, placed_high);
+        const __m256i min_placed_vec = _mm256_set1_epi16(static_cast<short>(min_placed));
+        const __m256i placed_lanes_low = _mm256_cmpeq_epi16(placed_low, min_placed_vec);
+        const __m256i placed_lanes_high = _mm256_cmpeq_epi16(placed_high, min_placed_vec);
+
+        // every candidate is an arrangement of the first one, so 4 bitboards worth of images cover all of them
+        __m256i attribute_low[4], attribute_high[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            all_images(candidates[0][i], attribute_low[i], attribute_high[i]);
+        }
+
+        uint64_t min_attributes = std::numeric_limits<uint64_t>::max();
+
+        for (int candidate = 0; candidate < candidate_count; ++candidate)
+        {
+            __m256i lanes_low = placed_lanes_low;
+            __m256i lanes_high = placed_lanes_high;
+            uint64_t attributes = 0;
+
+            // most significant bitboard first, every step only keeps the symmetries that are still minimal
+            for (int i = 3; i >= 0; --i)
+            {
+                int source = 0;
+                while (candidates[0][source] != candidates[candidate][i])
+                {
+                    ++source;
+                    assert(source < 4);
+                }
+
+                const __m256i low = attribute_low[source];
+                const __m256i high = attribute_high[source];
+
+                // symmetries that dropped out read as 0xffff so they can never lower the minimum
+                const uint16_t min_image = horizontal_min(
+                    _mm256_or_si256(low, _mm256_xor_si256(lanes_low, all_ones)),
+                    _mm256_or_si256(high, _mm256_xor_si256(lanes_high, all_ones)));
+                const __m256i min_image_vec = _mm256_set1_epi16(static_cast<short>(min_image));
+
+                lanes_low = _mm256_and_si256(lanes_low, _mm256_cmpeq_epi16(low, min_image_vec));
+                lanes_high = _mm256_and_si256(lanes_high, _mm256_cmpeq_epi16(high, min_image_vec));
+                attributes |= static_cast<uint64_t>(min_image) << (16 * i);
+            }
+
+            min_attributes = std::min(min_attributes, attributes);
+        }
+
+        return static_cast<__uint128_t>(min_placed) << 64 | min_attributes;
+    }
+#else
+    bool has_avx2_kernel()
+    {
+        return false;
+    }
+
+    __uint128_t minimal_key_avx2(const uint16_t placed, const uint16_t candidates[][4], const int candidate_count)
+    {
+        return minimal_key_scalar(placed, candidates, candidate_count);
+    }
+#endif
+
+    __uint128_t minimal_key(const uint16_t placed, const uint16_t candidates[][4], const int candidate_count)
+    {
+        using kernel = __uint128_t (*)(uint16_t, const uint16_t[][4], int);
+        static const kernel selected = has_avx2_kernel() ? minimal_key_avx2 : minimal_key_scalar;
+
+        return selected(placed, candidates, candidate_count);
+    }
+} // board // quarto
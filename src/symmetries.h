@@ -6,7 +6,7 @@
 
 namespace quarto::symmetries::board
 {
-    inline uint16_t rotate_clk(const uint16_t mat)
+    constexpr uint16_t rotate_clk(const uint16_t mat)
     {
         return
             ((mat & 0b1000000000000000) >> 3)
@@ -38,7 +38,7 @@ namespace quarto::symmetries::board
         }
     }
 
-    inline uint16_t mirror_vrt(const uint16_t mat)
+    constexpr uint16_t mirror_vrt(const uint16_t mat)
     {
         return
             ((mat & 0x8888) >> 3) // most left
@@ -56,7 +56,7 @@ namespace quarto::symmetries::board
         }
     }
 
-    inline uint16_t mirror_hor(const uint16_t mat)
+    constexpr uint16_t mirror_hor(const uint16_t mat)
     {
         return
             ((mat & 0xf000) >> 12) // top row
@@ -74,7 +74,7 @@ namespace quarto::symmetries::board
         }
     }
 
-    inline uint16_t inside_out(const uint16_t mat)
+    constexpr uint16_t inside_out(const uint16_t mat)
     {
         return
             ((mat & 0xa0a0) >> 5)
@@ -91,7 +91,7 @@ namespace quarto::symmetries::board
         }
     }
 
-    inline uint16_t mid_flip(const uint16_t mat)
+    constexpr uint16_t mid_flip(const uint16_t mat)
     {
         return
             (mat & 0x9009)
@@ -114,6 +114,138 @@ namespace quarto::symmetries::board
             board_state[i] = mid_flip(board_state[i]);
         }
     }
+
+    constexpr int SYMMETRY_COUNT{32};
+
+    /**
+     * Applies one of the 32 board symmetries canonize tries, in the same order get_minimized_symmetrical walks them:
+     * the upper 2 bits of the index are the number of clockwise rotations, the lower 3 bits select mirror_vrt,
+     * inside_out and mid_flip (applied in that order).
+     */
+    constexpr uint16_t apply_symmetry(const int symmetry, uint16_t mat)
+    {
+        assert(symmetry >= 0 && symmetry < SYMMETRY_COUNT);
+
+        for (int i = 0; i < symmetry >> 3; ++i)
+        {
+            mat = rotate_clk(mat);
+        }
+
+        if ((symmetry & 0b001) != 0)
+        {
+            mat = mirror_vrt(mat);
+        }
+
+        if ((symmetry & 0b010) != 0)
+        {
+            mat = inside_out(mat);
+        }
+
+        if ((symmetry & 0b100) != 0)
+        {
+            mat = mid_flip(mat);
+        }
+
+        return mat;
+    }
+
+    /**
+     * Every symmetry only moves bits around, so the image of a bitboard is the image of its high byte or'ed with the
+     * image of its low byte. Two 256 entry tables per symmetry, 32KB in total.
+     */
+    struct symmetry_tables
+    {
+        uint16_t high[SYMMETRY_COUNT][256];
+        uint16_t low[SYMMETRY_COUNT][256];
+    };
+
+    constexpr symmetry_tables build_symmetry_tables()
+    {
+        symmetry_tables tables{};
+
+        for (int symmetry = 0; symmetry < SYMMETRY_COUNT; ++symmetry)
+        {
+            uint16_t square_images[16]{};
+            for (int bit = 0; bit < 16; ++bit)
+            {
+                square_images[bit] = apply_symmetry(symmetry, static_cast<uint16_t>(1 << bit));
+            }
+
+            for (int byte = 0; byte < 256; ++byte)
+            {
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    if ((byte & (1 << bit)) != 0)
+                    {
+                        tables.low[symmetry][byte] |= square_images[bit];
+                        tables.high[symmetry][byte] |= square_images[bit + 8];
+                    }
+                }
+            }
+        }
+
+        return tables;
+    }
+
+    inline constexpr symmetry_tables SYMMETRY_TABLES = build_symmetry_tables();
+
+    /**
+     * Table driven equivalent of apply_symmetry
+     */
+    inline uint16_t transform(const int symmetry, const uint16_t mat)
+    {
+        return SYMMETRY_TABLES.high[symmetry][mat >> 8] | SYMMETRY_TABLES.low[symmetry][mat & 0xff];
+    }
+
+    /**
+     * Every symmetry again, but split per nibble and laid out so that one row holds the images of a nibble value under
+     * all 32 symmetries. Or'ing the 4 rows of a bitboard gives all of its 32 images at once, which is what the vector
+     * kernel loads.
+     */
+    struct nibble_tables
+    {
+        alignas(64) uint16_t images[4][16][SYMMETRY_COUNT];
+    };
+
+    constexpr nibble_tables build_nibble_tables()
+    {
+        nibble_tables tables{};
+
+        for (int nibble = 0; nibble < 4; ++nibble)
+        {
+            for (int value = 0; value < 16; ++value)
+            {
+                for (int symmetry = 0; symmetry < SYMMETRY_COUNT; ++symmetry)
+                {
+                    tables.images[nibble][value][symmetry] = apply_symmetry(
+                        symmetry, static_cast<uint16_t>(value << (4 * nibble)));
+                }
+            }
+        }
+
+        return tables;
+    }
+
+    inline constexpr nibble_tables NIBBLE_TABLES = build_nibble_tables();
+
+    /**
+     * Minimal key over all 32 symmetries of the placed bitboard together with every given arrangement of the attribute
+     * bitboards, same ordering as game::format. Every candidate has to be a permutation of the first one, as
+     * get_attribute_candidates gives them. Picks the fastest kernel the cpu supports on first use.
+     */
+    __uint128_t minimal_key(uint16_t placed, const uint16_t candidates[][4], int candidate_count);
+
+    __uint128_t minimal_key_scalar(uint16_t placed, const uint16_t candidates[][4], int candidate_count);
+
+    /**
+     * @return true if minimal_key_avx2 can run on this cpu
+     */
+    bool has_avx2_kernel();
+
+    /**
+     * Computes the 32 images of every bitboard in one pass with 256 bit vectors. Only call when has_avx2_kernel().
+     */
+    __uint128_t minimal_key_avx2(uint16_t placed, const uint16_t candidates[][4], int candidate_count);
 } // board // quarto
 
 #endif //SHMINIMAXING_SYMMETRIES_H
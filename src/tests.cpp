@@ -2,13 +2,25 @@
 #define SHMINIMAXING_TESTS_H
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include "game.h"
+#include "mcts_dag.h"
+#include "mcts_session.h"
+#include "node_arena.h"
+#include "position_book.h"
+#include "result_log.h"
 #include "saved_states.h"
+#include "transposition_table.h"
 #include "symmetries.h"
+#include "thread_pool.h"
 
 void test_game_init()
 {
@@ -126,6 +138,315 @@ void test_game_undo()
     assert(game.get_board_state()[4] == 0);
 }
 
+void test_game_copy_make()
+{
+    constexpr uint16_t boardState[5]{};
+    auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+    game.do_select(3);
+
+    const auto before = game.get_position();
+    const auto after = before.with_move(6);
+
+    // the source position is left untouched
+    assert(before.selected_piece == 3);
+    assert(before.board_state[quarto::game::BOARD_PLACED] == 0);
+
+    assert(after.selected_piece == INVALID_PIECE_SELECTION);
+    assert(after.board_state[quarto::game::BOARD_PLACED] == 0x0200);
+    assert(after.board_state[0] == 0);
+    assert(after.board_state[2] == 0x0200);
+
+    const auto selected = after.with_select(9);
+    assert(selected.selected_piece == 9);
+    assert(selected.selection_state == (game.get_selection_state() & ~0x0040));
+
+    // clone only copies the position, not the history
+    game.do_move(6);
+    auto cloned = game.clone();
+    assert(game.can_undo());
+    assert(!cloned.can_undo());
+    assert(cloned.get_board_state()[quarto::game::BOARD_PLACED] == 0x0200);
+
+    // a full game fits in the fixed undo history
+    game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+    for (int i = 0; i < 16; ++i)
+    {
+        game.do_select(i);
+        game.do_move(i);
+    }
+    assert(game.is_game_over());
+    for (int i = 0; i < quarto::game::MAX_UNDO_PLIES; ++i)
+    {
+        game.undo();
+    }
+    assert(!game.can_undo());
+    assert(game.get_selection_state() == DEFAULT_GAME_SELECTION_STATE);
+    assert(game.get_board_state()[quarto::game::BOARD_PLACED] == 0);
+}
+
+void test_line_state()
+{
+    std::mt19937 rng(11);
+
+    for (int i = 0; i < 500; ++i)
+    {
+        constexpr uint16_t boardState[5]{};
+        auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+
+        while (!game.is_game_over() && !game.is_quarto())
+        {
+            uint8_t selection = rng() % 16;
+            while ((game.get_selection_state() & (0x8000 >> selection)) == 0)
+            {
+                selection = (selection + 1) % 16;
+            }
+            game.do_select(selection);
+
+            // winning_squares has to agree with trying every empty square
+            uint16_t expected_squares = 0;
+            for (uint8_t square = 0; square < 16; ++square)
+            {
+                if ((game.get_board_state()[quarto::game::BOARD_PLACED] & (0x8000 >> square)) != 0)
+                {
+                    continue;
+                }
+
+                game.do_move(square);
+                if (game.is_quarto())
+                {
+                    expected_squares |= 0x8000 >> square;
+                }
+                game.undo();
+            }
+            assert(game.winning_squares(selection) == expected_squares);
+
+            uint8_t placement = rng() % 16;
+            while ((game.get_board_state()[quarto::game::BOARD_PLACED] & (0x8000 >> placement)) != 0)
+            {
+                placement = (placement + 1) % 16;
+            }
+            game.do_move(placement);
+
+            // the incremental line state matches one rebuilt from the bitboards
+            auto rebuilt = game.get_position();
+            rebuilt.recompute_lines();
+            assert(rebuilt.quarto == game.is_quarto());
+            assert(std::equal(std::begin(rebuilt.line_shared), std::end(rebuilt.line_shared),
+                              std::begin(game.get_position().line_shared)));
+
+            // a piece is poisoned exactly when it has a winning square
+            uint16_t expected_poisoned = 0;
+            for (uint8_t piece = 0; piece < 16; ++piece)
+            {
+                if ((game.get_selection_state() & (0x8000 >> piece)) != 0 && game.winning_squares(piece) != 0)
+                {
+                    expected_poisoned |= 0x8000 >> piece;
+                }
+            }
+            assert(game.poisoned_pieces() == expected_poisoned);
+        }
+    }
+
+    // three 0b0001 pieces on the top row, only 0b1110 shares no attribute with them
+    constexpr uint16_t boardState[5]{0x0000, 0x0000, 0x0000, 0xe000, 0xe000};
+    const auto game = quarto::game(boardState, 0x0fff, 0x67);
+    assert(game.winning_squares(15) == 0x1000); // 0b0000
+    assert(game.winning_squares(0) == 0x1000); // 0b1111 shares the fill
+    assert(game.winning_squares(1) == 0x1000); // 0b0111 shares the fill and the missing color
+    assert(game.winning_squares(8) == 0); // 0b1110
+}
+
+void test_move_generation()
+{
+    constexpr uint16_t boardState[5]{};
+    auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+    game.do_select(4);
+
+    quarto::move_list moves;
+    game.generate_moves(moves);
+    assert(game.move_count() == 16 * 15);
+    assert(moves.size == game.move_count());
+    assert(moves.moves[0] == 0x00);
+    assert(moves.moves[4] == 0x05); // piece 4 is no longer available
+    assert(moves.moves[moves.size - 1] == 0xff);
+
+    // late in the game only the empty squares and available pieces are generated
+    constexpr uint16_t lateBoardState[5]{0x0000, 0x0000, 0x0000, 0x0000, 0xfff6};
+    game = quarto::game(lateBoardState, 0x0041, 2);
+    game.generate_moves(moves);
+    assert(game.move_count() == 4);
+    assert(moves.size == 4);
+    assert(moves.moves[0] == 0xc9);
+    assert(moves.moves[1] == 0xcf);
+    assert(moves.moves[2] == 0xf9);
+    assert(moves.moves[3] == 0xff);
+
+    // three 0b0001 pieces on the top row and two 0b0000 on the second, with 0b1110 to place. Unless it closes the top
+    // row every piece left shares an attribute with it, so the only safe moves place on square 3
+    constexpr uint16_t poisonedBoardState[5]{0x0000, 0x0000, 0x0000, 0xe000, 0xe600};
+    game = quarto::game(poisonedBoardState, 0x0fff & ~0x0080, 8);
+    game.generate_safe_moves(moves);
+    assert(moves.size == 11);
+    assert(std::all_of(moves.begin(), moves.end(), [](const uint8_t move) { return (move >> 4) == 3; }));
+
+    // with no pieces left to select there are no safe moves either
+    game = quarto::game(lateBoardState, 0x0000, 2);
+    game.generate_safe_moves(moves);
+    assert(moves.empty());
+
+    uint16_t squares = 0x8001;
+    assert(quarto::pop_square(squares) == 0);
+    assert(quarto::pop_square(squares) == 15);
+    assert(squares == 0);
+}
+
+/**
+ * canonize_with_selection key of the position after the move
+ */
+std::pair<__uint128_t, uint8_t> child_key(const quarto::game& game, const uint8_t move)
+{
+    const auto child = quarto::game(game.get_position().with_move(move >> 4).with_select(move & 0xf));
+    uint8_t selection;
+    const auto key = child.canonize_with_selection(selection);
+    return {key, selection};
+}
+
+/**
+ * Minimal image of the position after the move over every board symmetry, attribute permutation and attribute flip
+ * (flipping only the placed squares). Slow, but unlike canonize it sees every flip.
+ */
+std::pair<__uint128_t, uint8_t> brute_force_child_key(const quarto::game& game, const uint8_t move)
+{
+    const auto child = game.get_position().with_move(move >> 4).with_select(move & 0xf);
+    const uint16_t placed = child.board_state[quarto::game::BOARD_PLACED];
+    std::pair<__uint128_t, uint8_t> best{~static_cast<__uint128_t>(0), 0xff};
+
+    for (int symmetry = 0; symmetry < quarto::symmetries::board::SYMMETRY_COUNT; ++symmetry)
+    {
+        const uint16_t placed_image = quarto::symmetries::board::transform(symmetry, placed);
+        int source[4]{0, 1, 2, 3};
+
+        do
+        {
+            for (int flips = 0; flips < 16; ++flips)
+            {
+                uint16_t image[5]{0, 0, 0, 0, placed_image};
+                uint8_t piece = 0;
+
+                for (int i = 0; i < 4; ++i)
+                {
+                    const bool flipped = (flips & 1 << i) != 0;
+                    image[i] = quarto::symmetries::board::transform(symmetry, child.board_state[source[i]])
+                        ^ (flipped ? placed_image : 0);
+                    piece |= ((quarto::QUARTO_PIECES[child.selected_piece] & 0x8 >> source[i]) != 0) != flipped
+                                 ? 0x8 >> i
+                                 : 0;
+                }
+
+                best = std::min(best, std::pair{quarto::game::format(image), quarto::PIECE_INDICES[piece]});
+            }
+        }
+        while (std::next_permutation(source, source + 4));
+    }
+
+    return best;
+}
+
+void test_symmetric_moves()
+{
+    std::mt19937 rng(13);
+
+    for (int i = 0; i < 300; ++i)
+    {
+        constexpr uint16_t boardState[5]{};
+        auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+
+        // mostly early positions, those are the ones with symmetries
+        for (int moves = rng() % 5; moves >= 0 && !game.is_quarto(); --moves)
+        {
+            uint8_t selection = rng() % 16;
+            while ((game.get_selection_state() & (0x8000 >> selection)) == 0)
+            {
+                selection = (selection + 1) % 16;
+            }
+            game.do_select(selection);
+
+            if (moves == 0)
+            {
+                break;
+            }
+
+            uint8_t placement = rng() % 16;
+            while ((game.get_board_state()[quarto::game::BOARD_PLACED] & (0x8000 >> placement)) != 0)
+            {
+                placement = (placement + 1) % 16;
+            }
+            game.do_move(placement);
+        }
+        if (game.is_quarto())
+        {
+            continue;
+        }
+
+        quarto::move_list all;
+        game.generate_moves(all);
+        quarto::move_list transposed = all;
+        game.remove_transposed_moves(transposed);
+        quarto::move_list symmetric = all;
+        game.remove_symmetric_moves(symmetric);
+
+        // one move for every distinct canonize key
+        std::vector<std::pair<__uint128_t, uint8_t>> all_keys;
+        std::vector<std::pair<__uint128_t, uint8_t>> transposed_keys;
+        for (const auto move : all)
+        {
+            all_keys.push_back(child_key(game, move));
+        }
+        for (const auto move : transposed)
+        {
+            transposed_keys.push_back(child_key(game, move));
+        }
+        std::sort(all_keys.begin(), all_keys.end());
+        all_keys.erase(std::unique(all_keys.begin(), all_keys.end()), all_keys.end());
+        std::sort(transposed_keys.begin(), transposed_keys.end());
+        assert(transposed_keys == all_keys);
+
+        // the stabilizer only drops moves equivalent to a kept one
+        if (i % 10 != 0)
+        {
+            continue;
+        }
+        std::vector<std::pair<__uint128_t, uint8_t>> all_full_keys;
+        std::vector<std::pair<__uint128_t, uint8_t>> symmetric_full_keys;
+        for (const auto move : all)
+        {
+            all_full_keys.push_back(brute_force_child_key(game, move));
+        }
+        for (const auto move : symmetric)
+        {
+            symmetric_full_keys.push_back(brute_force_child_key(game, move));
+        }
+        std::sort(all_full_keys.begin(), all_full_keys.end());
+        all_full_keys.erase(std::unique(all_full_keys.begin(), all_full_keys.end()), all_full_keys.end());
+        std::sort(symmetric_full_keys.begin(), symmetric_full_keys.end());
+        symmetric_full_keys.erase(std::unique(symmetric_full_keys.begin(), symmetric_full_keys.end()),
+                                  symmetric_full_keys.end());
+        assert(symmetric_full_keys == all_full_keys);
+    }
+
+    // the empty board has every symmetry, placing the first piece anywhere and handing over any piece
+    constexpr uint16_t boardState[5]{};
+    auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+    game.do_select(0);
+    quarto::move_list moves;
+    game.generate_moves(moves);
+    quarto::move_list transposed = moves;
+    game.remove_transposed_moves(transposed);
+    game.remove_symmetric_moves(moves);
+    assert(moves.size == 8);
+    assert(transposed.size == 8);
+}
+
 void test_eval_pos_2_moves()
 {
     constexpr uint16_t boardState[5]{};
@@ -168,7 +489,10 @@ void test_eval_pos_2_moves()
     assert((compute_move >> 4) == 15); // winning position
 }
 
-void test_eval_pos()
+/**
+ * A position where placing on square 13 or 15 wins
+ */
+quarto::game winning_position()
 {
     constexpr uint16_t boardState[5]{};
     auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
@@ -204,12 +528,175 @@ void test_eval_pos()
 
     assert(!game.is_quarto());
 
+    return game;
+}
+
+void test_eval_pos()
+{
+    const auto game = winning_position();
     uint8_t compute_move = game.compute_move(5000);
 
     std::cout << "computed move: " << int(compute_move >> 4) << std::endl;
     assert((compute_move >> 4) == 15 || (compute_move >> 4) == 13); // winning position
 }
 
+void test_parallel_search()
+{
+    // split at nearly every node, the parallel search has to find the same winning placements
+    quarto::search::set_split_min_empties(3);
+    saved_states::get_instance()->clear();
+    test_eval_pos();
+    saved_states::get_instance()->clear();
+    quarto::search::set_split_min_empties(DEFAULT_SPLIT_MIN_EMPTIES);
+
+    // more helpers than workers, the ones starting late find the search finished
+    auto game = winning_position();
+    auto search = quarto::search{};
+    const auto move = search.search_lazy_smp(game, 2 * quarto::thread_pool::get_instance().get_thread_count() + 1,
+                                             60000);
+    assert((move >> 4) == 15 || (move >> 4) == 13);
+    saved_states::get_instance()->clear();
+}
+
+void test_solve()
+{
+    auto winning = winning_position();
+    saved_states::get_instance()->clear();
+    assert(quarto::search::solve(winning) == 2);
+
+    // the null window answers have to agree with one full window search on positions of every value
+    std::mt19937 rng(11);
+    int values_seen = 0;
+
+    for (int i = 0; i < 40; ++i)
+    {
+        constexpr uint16_t boardState[5]{};
+        auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+
+        for (int move = 0; move < 10 && !game.is_quarto(); ++move)
+        {
+            uint8_t selection = rng() % 16;
+            while ((game.get_selection_state() & (0x8000 >> selection)) == 0)
+            {
+                selection = (selection + 1) % 16;
+            }
+            game.do_select(selection);
+
+            uint8_t placement = rng() % 16;
+            while ((game.get_board_state()[quarto::game::BOARD_PLACED] & (0x8000 >> placement)) != 0)
+            {
+                placement = (placement + 1) % 16;
+            }
+            game.do_move(placement);
+        }
+
+        if (game.is_quarto())
+        {
+            continue;
+        }
+
+        game.do_select(std::countl_zero(game.get_selection_state()));
+        auto position = game.clone();
+
+        saved_states::get_instance()->clear();
+        const auto full_window = quarto::search::solve(position, false);
+        saved_states::get_instance()->clear();
+        const auto null_window = quarto::search::solve(position);
+        assert(full_window == null_window);
+
+        // the order the moves are searched in never changes the value
+        quarto::search::set_move_ordering(i % 2 == 0 ? 0 : ORDER_HASH_MOVE | ORDER_KILLERS | ORDER_HISTORY);
+        saved_states::get_instance()->clear();
+        assert(quarto::search::solve(position) == null_window);
+        quarto::search::set_move_ordering(DEFAULT_MOVE_ORDERING);
+
+        values_seen |= 1 << (null_window + 2);
+    }
+
+    assert(values_seen == 0b10101);
+    saved_states::get_instance()->clear();
+}
+
+void test_iterative_search()
+{
+    // a forced win is found long before the deadline
+    auto winning = winning_position();
+    auto search = quarto::search{};
+    auto start = std::chrono::steady_clock::now();
+    auto move = search.search_iterative(winning, 60000);
+    assert((move >> 4) == 15 || (move >> 4) == 13);
+    assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(30));
+
+    // 5 pieces placed is far from solvable in 300 ms, the move of the last finished iteration comes back in time
+    constexpr uint16_t boardState[5]{};
+    auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+    game.do_select_piece(0b0000);
+    game.do_move(0);
+    game.do_select_piece(0b0001);
+    game.do_move(5);
+    game.do_select_piece(0b1110);
+    game.do_move(10);
+    game.do_select_piece(0b1010);
+    game.do_move(3);
+    game.do_select_piece(0b1111);
+    game.do_move(12);
+    game.do_select_piece(0b0100);
+
+    start = std::chrono::steady_clock::now();
+    move = search.search_iterative(game, 300);
+    assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1500));
+    assert((game.get_empty_squares() & (0x8000 >> (move >> 4))) != 0);
+    assert((game.get_selection_state() & (0x8000 >> (move & 0xf))) != 0);
+
+    // lazy smp has the same deadline
+    start = std::chrono::steady_clock::now();
+    move = search.search_lazy_smp(game, quarto::thread_pool::get_instance().get_thread_count(), 300);
+    assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1500));
+    assert((game.get_empty_squares() & (0x8000 >> (move >> 4))) != 0);
+    assert((game.get_selection_state() & (0x8000 >> (move & 0xf))) != 0);
+
+    // the last piece has one square left and no piece to hand over
+    std::mt19937 rng(3);
+    bool last_placement = false;
+    for (int attempt = 0; attempt < 1000 && !last_placement; ++attempt)
+    {
+        auto last = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+        last.do_select(rng() % 16);
+        while (!last.is_quarto() && last.get_selection_state() != 0)
+        {
+            quarto::move_list moves;
+            last.generate_safe_moves(moves);
+            if (moves.empty())
+            {
+                last.generate_moves(moves);
+            }
+            const auto random_move = moves.moves[rng() % moves.size];
+            last.do_move(random_move >> 4);
+            if (!last.is_quarto())
+            {
+                last.do_select(random_move & 0xf);
+            }
+        }
+
+        auto position = last.clone();
+        if (last.is_quarto() || position.winning_squares(position.get_selection_piece()) != 0)
+        {
+            continue;
+        }
+        last_placement = true;
+
+        move = search.search_iterative(position, 1000);
+        assert((move >> 4) == std::countl_zero(position.get_empty_squares()));
+        assert((move & 0xf) == 0);
+
+        move = search.search_lazy_smp(position, 2, 1000);
+        assert((move >> 4) == std::countl_zero(position.get_empty_squares()));
+        assert((move & 0xf) == 0);
+    }
+    assert(last_placement);
+    saved_states::get_instance()->clear();
+}
+
 void test_saving_loading()
 {
     auto original_size = saved_states::get_instance()->get_size();
@@ -290,11 +777,15 @@ void test_symmetries()
 
     assert(game.is_quarto());
 
-    quarto::symmetries::board::mirror_state_hor(game.get_board_state());
+    // the line state is derived from the bitboards, so every transformed board goes through a new game
+    quarto::symmetries::board::mirror_state_hor(boardState);
+    game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
     assert(game.is_quarto());
-    quarto::symmetries::board::rotate_state_clk(game.get_board_state());
+    quarto::symmetries::board::rotate_state_clk(boardState);
+    game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
     assert(game.is_quarto());
-    quarto::symmetries::board::mid_state_flip(game.get_board_state());
+    quarto::symmetries::board::mid_state_flip(boardState);
+    game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
     assert(game.is_quarto());
 
     for (int i = 0; i < 5; ++i)
@@ -305,6 +796,839 @@ void test_symmetries()
     assert(canonized == game.canonize());
 }
 
+void test_canonize_tables()
+{
+    for (int symmetry = 0; symmetry < quarto::symmetries::board::SYMMETRY_COUNT; ++symmetry)
+    {
+        for (uint32_t mat = 0; mat < 0x10000; mat += 0x0123)
+        {
+            assert(quarto::symmetries::board::transform(symmetry, mat) ==
+                quarto::symmetries::board::apply_symmetry(symmetry, mat));
+        }
+    }
+
+    // symmetry 8 is a single clockwise rotation
+    assert(quarto::symmetries::board::transform(8, 0xf000) == 0x1111);
+
+    std::mt19937 rng(7);
+    for (int i = 0; i < 2000; ++i)
+    {
+        constexpr uint16_t boardState[5]{};
+        auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+        const int moves = static_cast<int>(rng() % 17);
+
+        for (int move = 0; move < moves; ++move)
+        {
+            uint8_t selection = rng() % 16;
+            while ((game.get_selection_state() & (0x8000 >> selection)) == 0)
+            {
+                selection = (selection + 1) % 16;
+            }
+            game.do_select(selection);
+
+            uint8_t placement = rng() % 16;
+            while ((game.get_board_state()[quarto::game::BOARD_PLACED] & (0x8000 >> placement)) != 0)
+            {
+                placement = (placement + 1) % 16;
+            }
+            game.do_move(placement);
+        }
+
+        assert(game.canonize() == game.canonize_reference());
+
+        uint16_t candidates[MAX_ATTRIBUTE_CANDIDATES][4];
+        const auto placed = game.get_board_state()[quarto::game::BOARD_PLACED];
+        const int candidate_count = quarto::get_attribute_candidates(game.get_board_state(), candidates);
+        const auto scalar_key = quarto::symmetries::board::minimal_key_scalar(placed, candidates, candidate_count);
+        assert(scalar_key == game.canonize());
+
+        if (quarto::symmetries::board::has_avx2_kernel())
+        {
+            assert(quarto::symmetries::board::minimal_key_avx2(placed, candidates, candidate_count) == scalar_key);
+        }
+    }
+}
+
+void test_transposition_table()
+{
+    auto table = transposition_table(1);
+    transposition_table::entry value{};
+
+    const __uint128_t state = static_cast<__uint128_t>(0xabcd) << 64 | 0x0123456789abcdef;
+    assert(!table.probe(state, 3, value));
+
+    table.store(state, 3, -2, 5);
+    assert(table.probe(state, 3, value));
+    assert(value.value == -2 && value.depth == 5 && value.bound == transposition_table::BOUND_EXACT);
+    assert(!table.probe(state, 4, value));
+    assert(!table.probe(state ^ 1, 3, value));
+    assert(!table.probe(state ^ static_cast<__uint128_t>(1) << 64, 3, value));
+
+    // a shallower result does not overwrite a deeper one of the same search, a deeper one does
+    table.store(state, 3, 2, 4);
+    assert(table.probe(state, 3, value) && value.value == -2);
+    table.store(state, 3, 2, 6, transposition_table::BOUND_LOWER);
+    assert(table.probe(state, 3, value) && value.value == 2 && value.bound == transposition_table::BOUND_LOWER);
+
+    // the best move survives a result without one
+    table.store(state, 3, 2, 6, transposition_table::BOUND_EXACT, 0xf3);
+    assert(table.probe(state, 3, value) && value.best_move == 0xf3);
+    table.store(state, 3, 2, 6, transposition_table::BOUND_UPPER);
+    assert(table.probe(state, 3, value) && value.best_move == 0xf3 && value.bound == transposition_table::BOUND_UPPER);
+    table.store(state, 3, 2, 6, transposition_table::BOUND_LOWER, 0x00);
+    assert(table.probe(state, 3, value) && value.best_move == 0x00);
+
+    // after a new search even the shallow result replaces it
+    table.new_generation();
+    table.store(state, 3, 0, 1);
+    assert(table.probe(state, 3, value) && value.value == 0 && value.best_move == 0x00);
+    assert(table.get_size() == 1);
+
+    // a full table keeps the entries of the current search
+    table.clear();
+    assert(table.get_size() == 0);
+    table.new_generation();
+    for (uint64_t i = 0; i < table.get_capacity() * 2; ++i)
+    {
+        table.store(static_cast<__uint128_t>(i) << 8, 0, 1, 1);
+    }
+    table.new_generation();
+    table.store(static_cast<__uint128_t>(0xff), 1, -1, 0);
+    assert(table.probe(static_cast<__uint128_t>(0xff), 1, value) && value.value == -1);
+    assert(table.get_size() <= table.get_capacity());
+
+    size_t visited = 0;
+    table.for_each([&visited](const transposition_table::entry& e)
+    {
+        assert(e.value == 1 || (e.state == 0xff && e.selection == 1 && e.value == -1));
+        ++visited;
+    });
+    assert(visited == table.get_size());
+
+    table.erase_if([](const transposition_table::entry& e) { return e.value == 1; });
+    assert(table.get_size() == 1);
+
+    // writers racing for the same empty entries count each occupied one once
+    table.clear();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&table, t]
+        {
+            for (uint64_t i = 0; i < table.get_capacity(); ++i)
+            {
+                table.store(static_cast<__uint128_t>(i) << 8, t, 1, 1);
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    visited = 0;
+    table.for_each([&visited](const transposition_table::entry&) { ++visited; });
+    assert(visited == table.get_size());
+}
+
+void test_canonize_selection()
+{
+    std::mt19937 rng(5);
+    int shared_keys = 0;
+
+    for (int i = 0; i < 2000; ++i)
+    {
+        constexpr uint16_t boardState[5]{};
+        auto game = quarto::game(boardState, DEFAULT_GAME_SELECTION_STATE, 0x67);
+
+        for (int moves = rng() % 12; moves > 0 && !game.is_quarto(); --moves)
+        {
+            uint8_t selection = rng() % 16;
+            while ((game.get_selection_state() & (0x8000 >> selection)) == 0)
+            {
+                selection = (selection + 1) % 16;
+            }
+            game.do_select(selection);
+
+            uint8_t placement = rng() % 16;
+            while ((game.get_board_state()[quarto::game::BOARD_PLACED] & (0x8000 >> placement)) != 0)
+            {
+                placement = (placement + 1) % 16;
+            }
+            game.do_move(placement);
+        }
+
+        if (game.is_quarto())
+        {
+            continue;
+        }
+
+        uint8_t selection = rng() % 16;
+        while ((game.get_selection_state() & (0x8000 >> selection)) == 0)
+        {
+            selection = (selection + 1) % 16;
+        }
+        game.do_select(selection);
+
+        // a random board symmetry, attribute permutation and attribute flips, applied to the board and the pieces
+        const int symmetry = static_cast<int>(rng() % quarto::symmetries::board::SYMMETRY_COUNT);
+        int permutation[4]{0, 1, 2, 3};
+        std::shuffle(std::begin(permutation), std::end(permutation), rng);
+        const uint8_t flips = rng() % 16;
+
+        const uint16_t placed = game.get_board_state()[quarto::game::BOARD_PLACED];
+        uint16_t transformed[5]{};
+        for (int j = 0; j < 4; ++j)
+        {
+            const int source = permutation[j];
+            const uint16_t plane = game.get_board_state()[source] ^ ((flips & 1 << source) != 0 ? placed : 0);
+            transformed[j] = quarto::symmetries::board::apply_symmetry(symmetry, plane);
+        }
+        transformed[quarto::game::BOARD_PLACED] = quarto::symmetries::board::apply_symmetry(symmetry, placed);
+
+        auto transform_piece = [&](const uint8_t piece)
+        {
+            uint8_t attributes = 0;
+            for (int j = 0; j < 4; ++j)
+            {
+                const int source = permutation[j];
+                if (((quarto::QUARTO_PIECES[piece] & 0x8 >> source) != 0) != ((flips & 1 << source) != 0))
+                {
+                    attributes |= 0x8 >> j;
+                }
+            }
+            return quarto::PIECE_INDICES[attributes];
+        };
+
+        uint16_t selection_state = 0;
+        for (uint8_t piece = 0; piece < 16; ++piece)
+        {
+            if ((game.get_selection_state() & (0x8000 >> piece)) != 0)
+            {
+                selection_state |= 0x8000 >> transform_piece(piece);
+            }
+        }
+
+        const auto other = quarto::game(transformed, selection_state, transform_piece(selection));
+
+        uint8_t canonical_selection, other_selection;
+        const auto key = game.canonize_with_selection(canonical_selection);
+        const auto other_key = other.canonize_with_selection(other_selection);
+
+        assert(key == game.canonize());
+        assert(canonical_selection < 16);
+
+        if (key == other_key)
+        {
+            assert(canonical_selection == other_selection);
+            ++shared_keys;
+        }
+    }
+
+    std::cout << "transformed positions sharing the key: " << shared_keys << std::endl;
+    assert(shared_keys > 0);
+}
+
+void test_position_book()
+{
+    std::vector<position_book::record> records;
+    std::mt19937_64 rng(3);
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        const __uint128_t state = static_cast<__uint128_t>(rng() & 0xffff) << 64 | rng();
+        const auto selection = static_cast<uint8_t>(rng() % 16);
+        records.push_back(position_book::record{state, selection, static_cast<int8_t>(i % 2 ? 2 : -2)});
+    }
+
+    // a later record of the same key replaces the earlier one
+    records.push_back(position_book::record{
+        records[0].state, records[0].selection, static_cast<int8_t>(-records[0].value)
+    });
+
+    assert(position_book::write("test_position" BOOK_FILE_EXTENSION, records));
+
+    position_book book;
+    assert(book.open("test_position" BOOK_FILE_EXTENSION));
+    assert(book.get_size() == 1000);
+
+    for (size_t i = 1; i < book.get_size(); ++i)
+    {
+        const auto previous = book.get_record(i - 1);
+        const auto current = book.get_record(i);
+        assert(previous.state < current.state
+            || (previous.state == current.state && previous.selection < current.selection));
+    }
+
+    int value = 0;
+    for (size_t i = 1; i < 1000; ++i)
+    {
+        assert(book.probe(records[i].state, records[i].selection, value));
+        assert(value == records[i].value);
+    }
+    assert(book.probe(records[0].state, records[0].selection, value) && value == -records[0].value);
+    assert(!book.probe(records[1].state ^ 1, records[1].selection, value));
+    assert(!book.open("missing" BOOK_FILE_EXTENSION));
+
+    // a state file written by saved_states reads back with the same keys, and converts to a book
+    saved_states::get_instance()->clear();
+    saved_states::get_instance()->store_eval(records[1].state, records[1].selection, records[1].value,
+                                             transposition_table::FULL_DEPTH, transposition_table::BOUND_EXACT);
+    saved_states::get_instance()->save("test_book");
+
+    std::ifstream file("test_book.shmx", std::ios::in | std::ios::binary);
+    const std::vector<u_char> data(std::istreambuf_iterator<char>(file), {});
+    int record_count = 0;
+    const auto read = [&](const __uint128_t state, const uint8_t selection, const int8_t eval)
+    {
+        assert(state == records[1].state && selection == records[1].selection && eval == records[1].value);
+        ++record_count;
+    };
+    assert(saved_states::for_each_record(data, read));
+    assert(record_count == 1);
+
+    // a file without the header is from before values and selections changed meaning, nothing of it is read
+    const std::vector<u_char> legacy(data.begin() + 8, data.end());
+    record_count = 0;
+    assert(!saved_states::for_each_record(legacy, read));
+    assert(record_count == 0);
+
+    assert(saved_states::get_instance()->save_book("test_book"));
+    saved_states::get_instance()->clear();
+    transposition_table::entry saved{};
+    assert(saved_states::get_instance()->probe(records[1].state, records[1].selection, saved));
+    assert(saved.value == records[1].value && saved.bound == transposition_table::BOUND_EXACT);
+}
+
+void test_result_log()
+{
+    std::remove("test_log" LOG_FILE_EXTENSION);
+    std::remove("test_log" BOOK_FILE_EXTENSION);
+
+    auto log = std::make_unique<result_log>();
+    assert(log->open("test_log" LOG_FILE_EXTENSION));
+
+    // the batches of threads that exit are handed over on their own
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&log, t]()
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                log->append(position_book::record{static_cast<__uint128_t>(t) << 64 | i, 1, 2});
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    log->append(position_book::record{static_cast<__uint128_t>(7) << 64, 3, -2});
+    log->sync();
+
+    int records = 0;
+    int ones = 0;
+    assert(result_log::replay("test_log" LOG_FILE_EXTENSION, [&](const position_book::record& r)
+    {
+        assert(r.value == (r.selection == 1 ? 2 : -2));
+        ones += r.selection == 1 ? 1 : 0;
+        ++records;
+    }));
+    assert(records == 4001 && ones == 4000);
+
+    // a record cut short by a crash is skipped
+    log->close();
+    std::ofstream("test_log" LOG_FILE_EXTENSION, std::ios::out | std::ios::binary | std::ios::app) << "abc";
+    records = 0;
+    result_log::replay("test_log" LOG_FILE_EXTENSION, [&records](const position_book::record&) { ++records; });
+    assert(records == 4001);
+    log.reset();
+
+    // solved positions stored through saved_states end up in the log, and from there in the book
+    const auto states = std::make_unique<saved_states>();
+    states->resize_table(1);
+    states->load("test_log");
+    assert(states->get_total_size() == 4001);
+    states->clear();
+    assert(states->open_log("test_log"));
+
+    const __uint128_t solved = static_cast<__uint128_t>(0xf) << 64 | 0x1234;
+    const __uint128_t unsolved = static_cast<__uint128_t>(0xf) << 64 | 0x5678;
+    states->store_eval(solved, 0, 2, 12, transposition_table::BOUND_EXACT);
+    states->store_eval(unsolved, 0, 2, 12, transposition_table::BOUND_LOWER);
+    states->flush_log();
+
+    assert(states->compact("test_log"));
+    assert(states->get_book_size() == 4002);
+
+    records = 0;
+    result_log::replay("test_log" LOG_FILE_EXTENSION, [&records](const position_book::record&) { ++records; });
+    assert(records == 0);
+
+    states->clear();
+    transposition_table::entry saved{};
+    assert(states->probe(solved, 0, saved) && saved.value == 2);
+    assert(!states->probe(unsolved, 0, saved));
+}
+
+void test_thread_pool()
+{
+    auto pool = quarto::thread_pool(4);
+    std::atomic<int> leaves = 0;
+
+    // groups waited for inside tasks, more of them than there are workers
+    {
+        quarto::task_group outer(pool);
+        for (int i = 0; i < 16; ++i)
+        {
+            outer.run([&pool, &leaves]()
+            {
+                quarto::task_group inner(pool);
+                for (int j = 0; j < 16; ++j)
+                {
+                    inner.run([&leaves]() { leaves.fetch_add(1); });
+                }
+                inner.wait();
+            });
+        }
+        outer.wait();
+    }
+    assert(leaves == 256);
+
+    // the group waits in its destructor as well
+    {
+        quarto::task_group group(pool);
+        for (int i = 0; i < 100; ++i)
+        {
+            group.run([&leaves]() { leaves.fetch_add(1); });
+        }
+    }
+    assert(leaves == 356);
+    assert(pool.get_thread_count() == 4);
+}
+
+void test_playout()
+{
+    quarto::xoshiro256 rng(7);
+    for (int i = 0; i < 1000; ++i)
+    {
+        const auto value = rng.below(5);
+        assert(value < 5);
+    }
+
+    // piece 0 completes the top row
+    constexpr uint16_t board[5]{0xe000, 0xe000, 0xe000, 0xe000, 0xe000};
+    auto game = quarto::game(board, 0x1fff, INVALID_PIECE_SELECTION);
+    game.do_select(3);
+    assert(game.winning_squares(3) == 0x1000);
+    const auto position = game.get_position();
+
+    for (int i = 0; i < 100; ++i)
+    {
+        assert(quarto::search::playout(position, 1, rng) == quarto::search::WIN_SCORE);
+        assert(quarto::search::playout(position, -1, rng) == quarto::search::LOSS_SCORE);
+    }
+
+    // a quarto on the board was made by the player before
+    const auto finished = position.with_move(3);
+    assert(finished.quarto);
+    assert(quarto::search::playout(finished, 1, rng) == quarto::search::LOSS_SCORE);
+
+    // from the empty board every kind of result comes up
+    constexpr uint16_t empty_board[5]{};
+    auto selected = quarto::game(empty_board, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+    selected.do_select(5);
+    const auto start = selected.get_position();
+
+    bool seen[3]{};
+    for (int i = 0; i < 10000; ++i)
+    {
+        const auto result = quarto::search::playout(start, 1, rng);
+        assert(result == quarto::search::WIN_SCORE || result == quarto::search::LOSS_SCORE ||
+            result == quarto::search::DRAW_SCORE);
+        seen[result == quarto::search::WIN_SCORE ? 0 : result == quarto::search::LOSS_SCORE ? 1 : 2] = true;
+    }
+    assert(seen[0] && seen[1] && seen[2]);
+
+    // batches count every game
+    const auto won = quarto::search::playout_batch(position, 1, 64, rng);
+    assert(won.wins == 64 && won.games() == 64);
+    assert(won.score() == 64 * quarto::search::WIN_SCORE);
+    assert(quarto::search::playout_batch(finished, -1, 5, rng).wins == 5);
+
+    const auto mixed = quarto::search::playout_batch(start, 1, 10000, rng);
+    assert(mixed.games() == 10000);
+    assert(mixed.wins > 0 && mixed.draws > 0 && mixed.losses > 0);
+}
+
+void test_node_arena()
+{
+    // 1 MB holds a single chunk
+    quarto::node_arena arena(1);
+    assert(arena.get_capacity() == quarto::node_arena::CHUNK_SIZE);
+
+    const auto root = arena.allocate(1);
+    assert(root == 0);
+    assert(arena[root].parent == quarto::search_node::NO_NODE);
+    assert(!arena[root].is_expanded());
+
+    const auto block = arena.allocate(240);
+    assert(block == 1);
+    assert(&arena[block + 239] == &arena[block] + 239);
+
+    // a block that doesn't fit in what is left of the chunk doesn't get allocated
+    while (arena.allocate(240) != quarto::search_node::NO_NODE)
+    {
+    }
+    assert(arena.get_size() <= arena.get_capacity());
+    assert(arena.get_size() > arena.get_capacity() - 240);
+
+    // blocks start over in the next chunk
+    quarto::node_arena larger(8);
+    uint32_t last = 0;
+    for (int i = 0; i < 300; ++i)
+    {
+        last = larger.allocate(240);
+        assert(last != quarto::search_node::NO_NODE);
+        assert((last >> quarto::node_arena::CHUNK_BITS) == ((last + 239) >> quarto::node_arena::CHUNK_BITS));
+    }
+    assert(last >> quarto::node_arena::CHUNK_BITS == 1);
+
+    // the tree grows below the children of the root
+    constexpr uint16_t empty_board[5]{};
+    auto selected = quarto::game(empty_board, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+    selected.do_select(3);
+    auto game = selected.clone();
+    quarto::node_arena tree;
+    const auto tree_root = tree.allocate(1);
+    quarto::search::populate_children(tree, tree_root, game);
+    assert(tree[tree_root].child_count == 8);
+
+    bool deeper = false;
+    for (int i = 0; i < 2000; ++i)
+    {
+        const auto leaf = quarto::search::traverse(tree, tree_root, game);
+        quarto::search::backpropagate(tree, leaf, quarto::search::rollout(game));
+        deeper |= tree[leaf].parent != tree_root;
+
+        while (game.can_undo())
+        {
+            game.undo();
+        }
+    }
+    assert(deeper);
+    assert(tree[tree_root].n_visits() == 2000);
+
+    // a playout counts as a loss until its result is back
+    const auto t_before = tree[tree_root].get_t_score();
+    const auto leaf = quarto::search::traverse(tree, tree_root, game);
+    assert(tree[tree_root].n_visits() == 2001);
+    assert(tree[tree_root].get_t_score() == t_before - DEFAULT_VIRTUAL_LOSS);
+    // for the player picking it, which is the opponent below the root player's moves
+    const auto picked_by = game.move_side() == 1 ? -1 : 1;
+    const auto leaf_before = tree[leaf].get_t_score() + picked_by * DEFAULT_VIRTUAL_LOSS;
+    const auto result = quarto::search::rollout(game);
+    quarto::search::backpropagate(tree, leaf, result);
+    assert(tree[tree_root].get_t_score() == t_before + result.score());
+    assert(tree[leaf].get_t_score() == leaf_before + result.score());
+    while (game.can_undo())
+    {
+        game.undo();
+    }
+
+    // a batch of playouts is one update with all of its games
+    const auto batch_leaf = quarto::search::traverse(tree, tree_root, game);
+    const auto batch = quarto::search::rollout(game, 16);
+    assert(batch.games() == 16);
+    quarto::search::backpropagate(tree, batch_leaf, batch);
+    assert(tree[tree_root].n_visits() == 2017);
+    assert(tree[batch_leaf].n_visits() >= 16);
+    assert(tree[tree_root].get_t_score() == t_before + result.score() + batch.score());
+    while (game.can_undo())
+    {
+        game.undo();
+    }
+
+    // threads sharing the tree without locks lose no playouts
+    quarto::node_arena shared_tree;
+    const auto shared_root = shared_tree.allocate(1);
+    quarto::search::populate_children(shared_tree, shared_root, game);
+
+    std::atomic<int> score = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&shared_tree, shared_root, &score, game_copy = game.clone()]() mutable
+        {
+            for (int j = 0; j < 2000; ++j)
+            {
+                const auto shared_leaf = quarto::search::traverse(shared_tree, shared_root, game_copy);
+                const auto shared_result = quarto::search::rollout(game_copy);
+                quarto::search::backpropagate(shared_tree, shared_leaf, shared_result);
+                score += shared_result.score();
+
+                while (game_copy.can_undo())
+                {
+                    game_copy.undo();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    assert(shared_tree[shared_root].n_visits() == 8000);
+    assert(shared_tree[shared_root].get_t_score() == score);
+
+    int child_visits = 0;
+    const auto& shared = shared_tree[shared_root];
+    for (auto c = shared.first_child; c < shared.first_child + shared.child_count; ++c)
+    {
+        child_visits += shared_tree[c].n_visits();
+    }
+    assert(child_visits == 8000);
+}
+
+void test_mcts_solver()
+{
+    // piece 0 completes the top row on square 3
+    constexpr uint16_t board[5]{0xe000, 0xe000, 0xe000, 0xe000, 0xe000};
+    auto selected = quarto::game(board, 0x1fff, INVALID_PIECE_SELECTION);
+    selected.do_select(3);
+    auto game = selected.clone();
+
+    // solved as soon as it is expanded, the search doesn't need its time
+    quarto::node_arena arena;
+    const auto root = arena.allocate(1);
+    quarto::search::populate_children(arena, root, game);
+    assert(arena[root].get_proof() == quarto::search_node::PROVEN_WIN);
+    assert(arena[root].child_count == 1);
+    assert(quarto::search::best_child(arena, root) >> 4 == 3);
+
+    const auto start = std::chrono::steady_clock::now();
+    assert(quarto::search::search_mnt(game, 5000) >> 4 == 3);
+    assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+
+    // positions where every move hands over a piece that wins are lost, the proofs come up to the root
+    std::mt19937 rng(1);
+    int lost_positions = 0;
+    for (int attempt = 0; attempt < 20000 && lost_positions < 5; ++attempt)
+    {
+        constexpr uint16_t empty_board[5]{};
+        auto random = quarto::game(empty_board, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+        random.do_select(rng() % 16);
+        for (int i = 0; i < 7 && !random.is_quarto(); ++i)
+        {
+            quarto::move_list moves;
+            random.generate_safe_moves(moves);
+            if (moves.empty())
+            {
+                break;
+            }
+            const auto move = moves.moves[rng() % moves.size];
+            random.do_move(move >> 4);
+            random.do_select(move & 0xf);
+        }
+
+        auto position = random.clone();
+        quarto::move_list safe;
+        position.generate_safe_moves(safe);
+        if (random.is_quarto() || position.get_selection_piece() == INVALID_PIECE_SELECTION ||
+            position.winning_squares(position.get_selection_piece()) != 0 || !safe.empty() ||
+            position.get_selection_state() == 0)
+        {
+            continue;
+        }
+        ++lost_positions;
+
+        quarto::node_arena lost;
+        const auto lost_root = lost.allocate(1);
+        quarto::search::populate_children(lost, lost_root, position);
+        for (int i = 0; i < 10000 && !lost[lost_root].is_proven(); ++i)
+        {
+            const auto leaf = quarto::search::traverse(lost, lost_root, position);
+            quarto::search::backpropagate(lost, leaf, lost[leaf].is_proven()
+                                                          ? quarto::search::proven_result(lost[leaf], position, 1)
+                                                          : quarto::search::rollout(position));
+            while (position.can_undo())
+            {
+                position.undo();
+            }
+        }
+        assert(lost[lost_root].get_proof() == quarto::search_node::PROVEN_LOSS);
+    }
+    assert(lost_positions == 5);
+}
+
+/**
+ * Plays the first safe move that isn't a symmetry of an earlier one, the first reply monte carlo expands
+ */
+void play_first_reply(quarto::game& game)
+{
+    quarto::move_list replies;
+    game.generate_safe_moves(replies);
+    game.remove_symmetric_moves(replies);
+    assert(!replies.empty());
+    game.do_move(replies.moves[0] >> 4);
+    game.do_select(replies.moves[0] & 0xf);
+}
+
+void test_mcts_session()
+{
+    constexpr uint16_t empty_board[5]{};
+    auto start = quarto::game(empty_board, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+    start.do_select(0);
+
+    quarto::mcts_session session(64);
+    auto game = start.clone();
+    const auto first = session.search(game, 300);
+    assert(session.get_reused_visits() == 0);
+
+    // the opponent answers with a move in the tree, its subtree is searched further
+    game.do_move(first >> 4);
+    game.do_select(first & 0xf);
+    play_first_reply(game);
+    auto reply = game.clone();
+    const auto second = session.search(reply, 300);
+    assert(session.get_reused_visits() > 0);
+
+    // the same with the board turned, which only the canonical key finds, and the move has to fit the turned board
+    reply.do_move(second >> 4);
+    reply.do_select(second & 0xf);
+    play_first_reply(reply);
+    const auto& state = reply.get_position();
+    int symmetry = 1;
+    while (quarto::symmetries::board::transform(symmetry, state.board_state[quarto::game::BOARD_PLACED]) ==
+           state.board_state[quarto::game::BOARD_PLACED])
+    {
+        ++symmetry;
+    }
+    uint16_t turned_board[5];
+    for (int i = 0; i < 5; ++i)
+    {
+        turned_board[i] = quarto::symmetries::board::transform(symmetry, state.board_state[i]);
+    }
+    const auto turned = quarto::game(turned_board, state.selection_state, state.selected_piece);
+    const auto third = session.search(turned, 300);
+    assert(session.get_reused_visits() > 0);
+    assert((turned.get_empty_squares() & (0x8000 >> (third >> 4))) != 0);
+    assert((turned.get_position().with_move(third >> 4).selection_state & (0x8000 >> (third & 0xf))) != 0);
+
+    // a position the tree never got to starts over
+    session.search(start.clone(), 100);
+    assert(session.get_reused_visits() == 0);
+
+    // a copied subtree keeps its statistics and its shape
+    quarto::node_arena arena(16);
+    const auto root = arena.allocate(1);
+    auto position = start.clone();
+    quarto::search::populate_children(arena, root, position);
+    for (int i = 0; i < 2000; ++i)
+    {
+        const auto leaf = quarto::search::traverse(arena, root, position);
+        quarto::search::backpropagate(arena, leaf, quarto::search::rollout(position));
+        while (position.can_undo())
+        {
+            position.undo();
+        }
+    }
+    auto most_visited = arena[root].first_child;
+    for (uint32_t i = 1; i < arena[root].child_count; ++i)
+    {
+        if (arena[arena[root].first_child + i].n_visits() > arena[most_visited].n_visits())
+        {
+            most_visited = arena[root].first_child + i;
+        }
+    }
+    const auto& child = arena[most_visited];
+    assert(child.child_count > 0);
+    quarto::node_arena copy(16);
+    const auto copied = copy.copy_subtree(arena, most_visited);
+    assert(copy[copied].n_visits() == child.n_visits());
+    assert(copy[copied].get_t_score() == child.get_t_score());
+    assert(copy[copied].child_count == child.child_count);
+    assert(copy[copied].parent == quarto::search_node::NO_NODE);
+    assert(copy[copy[copied].first_child].parent == copied);
+    assert(copy[copy[copied].first_child].move == arena[child.first_child].move);
+}
+
+void test_mcts_dag()
+{
+    // the same position reached by two move orders, and turned, is one position of the dag
+    constexpr uint16_t empty_board[5]{};
+    auto start = quarto::game(empty_board, DEFAULT_GAME_SELECTION_STATE, INVALID_PIECE_SELECTION);
+    start.do_select(0);
+    const auto root_state = start.get_position();
+    const auto first_order = root_state.with_move(0).with_select(1).with_move(5).with_select(2);
+    const auto second_order = root_state.with_move(5).with_select(1).with_move(0).with_select(2);
+    assert(first_order.board_state[quarto::game::BOARD_PLACED] == second_order.board_state[quarto::game::BOARD_PLACED]);
+
+    quarto::mcts_dag dag(16);
+    const auto position = dag.find_or_insert(first_order);
+    assert(position != quarto::search_node::NO_NODE);
+    assert(dag.find_or_insert(first_order) == position);
+    assert(dag.find_or_insert(first_order.with_move(3).with_select(4)) != position);
+    assert(dag.get_size() == 2);
+
+    uint16_t turned_board[5];
+    for (int i = 0; i < 5; ++i)
+    {
+        turned_board[i] = quarto::symmetries::board::rotate_clk(first_order.board_state[i]);
+    }
+    const auto turned = quarto::game(turned_board, first_order.selection_state, first_order.selected_piece);
+    assert(dag.find_or_insert(turned.get_position()) == position);
+    // the position keeps the orientation it was added with
+    assert(dag[position].state.board_state[quarto::game::BOARD_PLACED] ==
+        first_order.board_state[quarto::game::BOARD_PLACED]);
+
+    // every playout goes through the root and one of its edges, the positions it reaches are shared
+    quarto::mcts_dag search_dag(16);
+    const auto root = search_dag.find_or_insert(root_state);
+    search_dag[root].begin_expansion();
+    quarto::search::expand_dag(search_dag, root);
+    quarto::dag_path path;
+    constexpr int iterations = 3000;
+    for (int i = 0; i < iterations; ++i)
+    {
+        quarto::search::traverse_dag(search_dag, root, path);
+        const auto& leaf = search_dag[path.positions[path.length]];
+        quarto::search::backpropagate_dag(search_dag, path, quarto::search::rollout(quarto::game(leaf.state)));
+    }
+    assert(search_dag[root].n_visits() == iterations);
+    int edge_visits = 0;
+    for (auto e = search_dag[root].first_edge; e < search_dag[root].first_edge + search_dag[root].edge_count; ++e)
+    {
+        edge_visits += search_dag.edge(e).n.load();
+    }
+    assert(edge_visits == iterations);
+
+    // a pending playout is a loss for whoever picked each position on its way
+    quarto::search::traverse_dag(search_dag, root, path);
+    assert(path.length >= 2);
+    int pending[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        pending[i] = search_dag[path.positions[i]].t.load();
+    }
+    const auto& leaf = search_dag[path.positions[path.length]];
+    const auto result = quarto::search::rollout(quarto::game(leaf.state));
+    quarto::search::backpropagate_dag(search_dag, path, result);
+    assert(search_dag[path.positions[0]].t.load() == pending[0] + DEFAULT_VIRTUAL_LOSS + result.score());
+    assert(search_dag[path.positions[1]].t.load() == pending[1] + DEFAULT_VIRTUAL_LOSS + result.score());
+    assert(search_dag[path.positions[2]].t.load() == pending[2] - DEFAULT_VIRTUAL_LOSS + result.score());
+
+    // piece 0 completes the top row on square 3
+    constexpr uint16_t board[5]{0xe000, 0xe000, 0xe000, 0xe000, 0xe000};
+    auto selected = quarto::game(board, 0x1fff, INVALID_PIECE_SELECTION);
+    selected.do_select(3);
+    auto game = selected.clone();
+    assert(quarto::search::search_dag(game, 200) >> 4 == 3);
+}
+
 int main()
 {
     std::cout << "Starting tests" << std::endl;
@@ -318,16 +1642,52 @@ int main()
     std::cout << "Finished select move tests" << std::endl;
     test_game_undo();
     std::cout << "Finished undo tests" << std::endl;
+    test_game_copy_make();
+    std::cout << "Finished copy-make tests" << std::endl;
+    test_line_state();
+    std::cout << "Finished line state tests" << std::endl;
+    test_move_generation();
+    std::cout << "Finished move generation tests" << std::endl;
+    test_symmetric_moves();
+    std::cout << "Finished symmetric move tests" << std::endl;
     test_symmetries();
     std::cout << "Finished symetry tests" << std::endl;
+    test_canonize_tables();
+    std::cout << "Finished canonize table tests" << std::endl;
+    test_canonize_selection();
+    std::cout << "Finished canonize selection tests" << std::endl;
+    test_thread_pool();
+    std::cout << "Finished thread pool tests" << std::endl;
+    test_node_arena();
+    std::cout << "Finished node arena tests" << std::endl;
+    test_playout();
+    std::cout << "Finished playout tests" << std::endl;
+    test_mcts_solver();
+    std::cout << "Finished monte carlo solver tests" << std::endl;
+    test_mcts_session();
+    std::cout << "Finished monte carlo session tests" << std::endl;
+    test_mcts_dag();
+    std::cout << "Finished monte carlo dag tests" << std::endl;
+    test_transposition_table();
+    std::cout << "Finished transposition table tests" << std::endl;
     test_eval_pos();
     std::cout << "Finished searching tests" << std::endl;
+    test_parallel_search();
+    std::cout << "Finished parallel searching tests" << std::endl;
+    test_solve();
+    std::cout << "Finished null window solver tests" << std::endl;
+    test_iterative_search();
+    std::cout << "Finished iterative search tests" << std::endl;
     test_eval_pos_2_moves();
 
     //return 0;
     std::cout << "Finished searching test for 2 moves" << std::endl;
     test_saving_loading();
     std::cout << "Finished loading/saving tests" << std::endl;
+    test_position_book();
+    std::cout << "Finished position book tests" << std::endl;
+    test_result_log();
+    std::cout << "Finished result log tests" << std::endl;
 
     auto start = std::chrono::high_resolution_clock::now();
 
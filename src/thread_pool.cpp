@@ -0,0 +1,218 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace quarto
+{
+    thread_pool& thread_pool::get_instance()
+    {
+        static thread_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    thread_pool::thread_pool(const size_t thread_count)
+    {
+        assert(thread_count > 0);
+
+        for (size_t i = 0; i <= thread_count; ++i)
+        {
+            queues.push_back(std::make_unique<task_queue>());
+        }
+
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            workers.emplace_back(&thread_pool::worker_loop, this, static_cast<int>(i));
+        }
+    }
+
+    thread_pool::~thread_pool()
+    {
+        {
+            std::lock_guard lock(sleep_mtx);
+            stopping = true;
+        }
+        sleep_cv.notify_all();
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void thread_pool::submit(std::function<void()> task)
+    {
+        const size_t index = worker_pool == this ? worker_index : workers.size();
+
+        {
+            std::lock_guard lock(queues[index]->mtx);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+
+        {
+            // taken so a worker that just found nothing to do can't miss the notify
+            std::lock_guard lock(sleep_mtx);
+            queued.fetch_add(1, std::memory_order_release);
+        }
+        sleep_cv.notify_one();
+    }
+
+    bool thread_pool::pop_task(std::function<void()>& task)
+    {
+        if (queued.load(std::memory_order_acquire) == 0)
+        {
+            return false;
+        }
+
+        // own work newest first, keeps the deque of a worker close to a depth first search
+        if (worker_pool == this)
+        {
+            auto& own = *queues[worker_index];
+            std::lock_guard lock(own.mtx);
+
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        // everything else oldest first, those are the biggest pieces of work. Other workers come before the shared
+        // queue so work that was split off is finished before new work from outside is started.
+        const size_t start = worker_pool == this ? worker_index + 1 : 0;
+        for (size_t offset = 0; offset < queues.size(); ++offset)
+        {
+            const size_t index = offset + 1 == queues.size() ? workers.size() : (start + offset) % workers.size();
+            auto& victim = *queues[index];
+            std::lock_guard lock(victim.mtx);
+
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool thread_pool::run_pending_task()
+    {
+        std::function<void()> task;
+
+        if (!pop_task(task))
+        {
+            return false;
+        }
+
+        task();
+        return true;
+    }
+
+    size_t thread_pool::get_thread_count() const
+    {
+        return workers.size();
+    }
+
+    bool thread_pool::is_worker() const
+    {
+        return worker_pool == this;
+    }
+
+    void thread_pool::worker_loop(const int index)
+    {
+        worker_index = index;
+        worker_pool = this;
+
+        while (true)
+        {
+            if (run_pending_task())
+            {
+                continue;
+            }
+
+            std::unique_lock lock(sleep_mtx);
+            sleep_cv.wait(lock, [this] { return queued.load(std::memory_order_acquire) != 0 || stopping; });
+
+            if (stopping)
+            {
+                return;
+            }
+        }
+    }
+
+    task_group::task_group(thread_pool& pool) : pool(pool)
+    {
+    }
+
+    task_group::~task_group()
+    {
+        wait();
+    }
+
+    void task_group::run(std::function<void()> task)
+    {
+        pending.fetch_add(1, std::memory_order_relaxed);
+
+        pool.submit([this, &pool = pool, task = std::move(task)]()
+        {
+            task();
+
+            if (pending.fetch_sub(1, std::memory_order_release) == 1)
+            {
+                // the group may be gone as soon as pending is 0, only the pool is used from here on
+                std::lock_guard lock(pool.done_mtx);
+                pool.done_cv.notify_all();
+            }
+        });
+    }
+
+    void task_group::wait()
+    {
+        if (!pool.is_worker())
+        {
+            // helping from outside would only add a thread to a pool that already has one per core, and the shared
+            // queue would hand it unrelated work first
+            std::unique_lock lock(pool.done_mtx);
+            pool.done_cv.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+            return;
+        }
+
+        while (pending.load(std::memory_order_acquire) != 0)
+        {
+            if (!pool.run_pending_task())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool task_group::wait_until(const std::chrono::steady_clock::time_point deadline)
+    {
+        if (!pool.is_worker())
+        {
+            std::unique_lock lock(pool.done_mtx);
+            return pool.done_cv.wait_until(lock, deadline,
+                                           [this] { return pending.load(std::memory_order_acquire) == 0; });
+        }
+
+        while (pending.load(std::memory_order_acquire) != 0)
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;
+            }
+
+            if (!pool.run_pending_task())
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        return true;
+    }
+} // quarto
@@ -0,0 +1,111 @@
+#ifndef SHMINIMAXING_THREAD_POOL_H
+#define SHMINIMAXING_THREAD_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace quarto
+{
+    /**
+     * Work stealing pool, every worker owns a deque it pushes to and pops from the back of, idle workers steal from the
+     * front of the others. Tasks submitted from outside the pool go to a shared queue. The workers live as long as the
+     * pool, so searches don't pay for starting threads.
+     */
+    class thread_pool
+    {
+    public:
+        /**
+         * The pool the engine uses, one worker per hardware thread
+         */
+        static thread_pool& get_instance();
+
+        explicit thread_pool(size_t thread_count);
+        ~thread_pool();
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        void submit(std::function<void()> task);
+
+        /**
+         * Runs one queued task on the calling thread, this is how waiting threads help instead of blocking
+         *
+         * @return false if there was nothing to run
+         */
+        bool run_pending_task();
+
+        [[nodiscard]] size_t get_thread_count() const;
+
+        /**
+         * @return true if called from one of the workers of this pool
+         */
+        [[nodiscard]] bool is_worker() const;
+
+    private:
+        friend class task_group;
+
+        struct task_queue
+        {
+            std::mutex mtx;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        // one queue per worker and the shared one for outside threads last
+        std::vector<std::unique_ptr<task_queue>> queues;
+        std::vector<std::thread> workers;
+
+        std::mutex sleep_mtx;
+        std::condition_variable sleep_cv;
+        std::atomic<size_t> queued{0};
+        bool stopping = false;
+
+        // signalled whenever a task_group finishes its last task
+        std::mutex done_mtx;
+        std::condition_variable done_cv;
+
+        // the queue of the worker running on this thread, -1 outside the pool
+        inline static thread_local int worker_index = -1;
+        inline static thread_local const thread_pool* worker_pool = nullptr;
+
+        bool pop_task(std::function<void()>& task);
+        void worker_loop(int index);
+    };
+
+    /**
+     * Tasks that are waited for together. A worker waiting for a group runs queued tasks in the meantime, so a task may
+     * start and wait for a group of its own without tying up a worker. Any other thread just blocks.
+     */
+    class task_group
+    {
+    public:
+        explicit task_group(thread_pool& pool = thread_pool::get_instance());
+        ~task_group();
+
+        task_group(const task_group&) = delete;
+        task_group& operator=(const task_group&) = delete;
+
+        void run(std::function<void()> task);
+        void wait();
+
+        /**
+         * wait that gives up at the deadline, a worker only notices it between the tasks it runs meanwhile
+         *
+         * @return true if every task finished
+         */
+        bool wait_until(std::chrono::steady_clock::time_point deadline);
+
+    private:
+        thread_pool& pool;
+        std::atomic<int> pending{0};
+    };
+} // quarto
+
+#endif //SHMINIMAXING_THREAD_POOL_H
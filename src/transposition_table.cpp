@@ -0,0 +1,256 @@
+#include "transposition_table.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <limits>
+
+namespace
+{
+    // layout of the data word
+    constexpr int SELECTION_SHIFT{16};
+    constexpr int VALUE_SHIFT{24};
+    constexpr int DEPTH_SHIFT{32};
+    constexpr int GENERATION_SHIFT{40};
+    constexpr uint64_t OCCUPIED_BIT{1ull << 48};
+    constexpr int BOUND_SHIFT{49};
+    constexpr int MOVE_SHIFT{51}; // 9 bits, NO_MOVE when there is none
+    constexpr uint64_t KEY_MASK{0xffffff}; // upper 16 bits of the board + the selection
+
+    uint64_t key_bits(const __uint128_t state, const uint8_t selection)
+    {
+        return static_cast<uint16_t>(state >> 64) | static_cast<uint64_t>(selection) << SELECTION_SHIFT;
+    }
+
+    uint8_t depth_of(const uint64_t data)
+    {
+        return static_cast<uint8_t>(data >> DEPTH_SHIFT);
+    }
+
+    uint8_t generation_of(const uint64_t data)
+    {
+        return static_cast<uint8_t>(data >> GENERATION_SHIFT);
+    }
+
+    // splitmix64 finalizer
+    uint64_t mix(uint64_t x)
+    {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111eb;
+        x ^= x >> 31;
+        return x;
+    }
+}
+
+transposition_table::entry transposition_table::to_entry(const uint64_t key_word, const uint64_t data)
+{
+    return entry{
+        static_cast<__uint128_t>(static_cast<uint16_t>(data)) << 64 | (key_word ^ data),
+        static_cast<uint8_t>(data >> SELECTION_SHIFT),
+        static_cast<int8_t>(data >> VALUE_SHIFT),
+        depth_of(data),
+        static_cast<uint8_t>(data >> BOUND_SHIFT & 0x3),
+        static_cast<uint16_t>(data >> MOVE_SHIFT & 0x1ff),
+    };
+}
+
+transposition_table::transposition_table(const size_t size_mb)
+{
+    resize(size_mb);
+}
+
+transposition_table::bucket& transposition_table::get_bucket(const __uint128_t state, const uint8_t selection) const
+{
+    const auto hash = mix(static_cast<uint64_t>(state) ^ mix(key_bits(state, selection)));
+    return buckets[hash & bucket_mask];
+}
+
+bool transposition_table::probe(const __uint128_t state, const uint8_t selection, entry& result) const
+{
+    const auto& b = get_bucket(state, selection);
+    const uint64_t key = key_bits(state, selection);
+    const auto lower = static_cast<uint64_t>(state);
+
+    for (int i = 0; i < ENTRIES_PER_BUCKET; ++i)
+    {
+        const uint64_t data = b.data[i].load(std::memory_order_relaxed);
+
+        if ((data & OCCUPIED_BIT) == 0 || (data & KEY_MASK) != key)
+        {
+            continue;
+        }
+
+        const uint64_t key_word = b.keys[i].load(std::memory_order_relaxed);
+
+        if ((key_word ^ data) != lower)
+        {
+            continue;
+        }
+
+        result = to_entry(key_word, data);
+        return true;
+    }
+
+    return false;
+}
+
+void transposition_table::store(const __uint128_t state, const uint8_t selection, const int value, const uint8_t depth,
+                                const uint8_t bound, uint16_t best_move)
+{
+    assert(value >= std::numeric_limits<int8_t>::min() && value <= std::numeric_limits<int8_t>::max());
+    assert(bound <= BOUND_UPPER);
+    assert(best_move <= NO_MOVE);
+
+    auto& b = get_bucket(state, selection);
+    const uint64_t key = key_bits(state, selection);
+    const auto lower = static_cast<uint64_t>(state);
+    const uint8_t current_generation = generation.load(std::memory_order_relaxed);
+
+    int replace = -1;
+    int empty = -1;
+    int lowest = -1;
+    int lowest_score = std::numeric_limits<int>::max();
+
+    for (int i = 0; i < ENTRIES_PER_BUCKET; ++i)
+    {
+        const uint64_t data = b.data[i].load(std::memory_order_relaxed);
+
+        if ((data & OCCUPIED_BIT) == 0)
+        {
+            if (empty == -1)
+            {
+                empty = i;
+            }
+            continue;
+        }
+
+        if ((data & KEY_MASK) == key && (b.keys[i].load(std::memory_order_relaxed) ^ data) == lower)
+        {
+            if (depth < depth_of(data) && generation_of(data) == current_generation)
+            {
+                return; // keep the deeper result
+            }
+
+            if (best_move == NO_MOVE)
+            {
+                best_move = static_cast<uint16_t>(data >> MOVE_SHIFT & 0x1ff);
+            }
+
+            replace = i;
+            break;
+        }
+
+        // entries of the current search always outrank older ones, after that the deepest one stays
+        const int score = depth_of(data) + (generation_of(data) == current_generation ? 0x100 : 0);
+        if (score < lowest_score)
+        {
+            lowest_score = score;
+            lowest = i;
+        }
+    }
+
+    if (replace == -1)
+    {
+        replace = empty != -1 ? empty : lowest;
+    }
+
+    const uint64_t data = key
+        | static_cast<uint64_t>(static_cast<uint8_t>(value)) << VALUE_SHIFT
+        | static_cast<uint64_t>(depth) << DEPTH_SHIFT
+        | static_cast<uint64_t>(current_generation) << GENERATION_SHIFT
+        | OCCUPIED_BIT
+        | static_cast<uint64_t>(bound) << BOUND_SHIFT
+        | static_cast<uint64_t>(best_move) << MOVE_SHIFT;
+
+    uint64_t expected = 0;
+    if (replace != empty || !b.data[replace].compare_exchange_strong(expected, data, std::memory_order_relaxed))
+    {
+        // another writer may have claimed the empty entry first, that one is overwritten without being counted twice
+        b.data[replace].store(data, std::memory_order_relaxed);
+    }
+    else
+    {
+        size.fetch_add(1, std::memory_order_relaxed);
+    }
+    b.keys[replace].store(lower ^ data, std::memory_order_relaxed);
+}
+
+void transposition_table::new_generation()
+{
+    generation.fetch_add(1, std::memory_order_relaxed);
+}
+
+void transposition_table::resize(const size_t size_mb)
+{
+    const size_t bucket_count = std::bit_floor(std::max<size_t>(1, size_mb * 1024 * 1024 / sizeof(bucket)));
+
+    buckets = std::make_unique<bucket[]>(bucket_count);
+    bucket_mask = bucket_count - 1;
+    size.store(0, std::memory_order_relaxed);
+}
+
+void transposition_table::clear()
+{
+    for (size_t i = 0; i <= bucket_mask; ++i)
+    {
+        for (int j = 0; j < ENTRIES_PER_BUCKET; ++j)
+        {
+            buckets[i].data[j].store(0, std::memory_order_relaxed);
+            buckets[i].keys[j].store(0, std::memory_order_relaxed);
+        }
+    }
+    size.store(0, std::memory_order_relaxed);
+}
+
+void transposition_table::for_each(const std::function<void(const entry&)>& callback) const
+{
+    for (size_t i = 0; i <= bucket_mask; ++i)
+    {
+        for (int j = 0; j < ENTRIES_PER_BUCKET; ++j)
+        {
+            const uint64_t data = buckets[i].data[j].load(std::memory_order_relaxed);
+
+            if ((data & OCCUPIED_BIT) == 0)
+            {
+                continue;
+            }
+
+            callback(to_entry(buckets[i].keys[j].load(std::memory_order_relaxed), data));
+        }
+    }
+}
+
+void transposition_table::erase_if(const std::function<bool(const entry&)>& predicate)
+{
+    for (size_t i = 0; i <= bucket_mask; ++i)
+    {
+        for (int j = 0; j < ENTRIES_PER_BUCKET; ++j)
+        {
+            const uint64_t data = buckets[i].data[j].load(std::memory_order_relaxed);
+
+            if ((data & OCCUPIED_BIT) == 0)
+            {
+                continue;
+            }
+
+            if (predicate(to_entry(buckets[i].keys[j].load(std::memory_order_relaxed), data)))
+            {
+                buckets[i].data[j].store(0, std::memory_order_relaxed);
+                buckets[i].keys[j].store(0, std::memory_order_relaxed);
+                size.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+size_t transposition_table::get_size() const
+{
+    return size.load(std::memory_order_relaxed);
+}
+
+size_t transposition_table::get_capacity() const
+{
+    return (bucket_mask + 1) * ENTRIES_PER_BUCKET;
+}
@@ -0,0 +1,96 @@
+#ifndef SHMINIMAXING_TRANSPOSITION_TABLE_H
+#define SHMINIMAXING_TRANSPOSITION_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#define DEFAULT_TRANSPOSITION_TABLE_MB 64
+
+/**
+ * Fixed size, lock free hash table from (canonized board, selection) to an evaluation.
+ *
+ * Every bucket is one cache line of 4 entries. An entry is two 64 bit words, the data word holds the upper 16 bits of
+ * the board, the selection, the value, the bound type, the best move and the replacement info, the key word holds the lower 64 bits
+ * of the board xor'ed with the data word. Readers and writers never lock, a read that races with a write sees a key word and data
+ * word that don't belong together and the xor check rejects it.
+ */
+class transposition_table
+{
+public:
+    constexpr static int ENTRIES_PER_BUCKET{4};
+    // depth stored for results that did not come from a depth limited search (like the ones loaded from disk)
+    constexpr static uint8_t FULL_DEPTH{0xff};
+
+    // the stored value is the exact result, a lower bound (fail high) or an upper bound (fail low)
+    constexpr static uint8_t BOUND_EXACT{0};
+    constexpr static uint8_t BOUND_LOWER{1};
+    constexpr static uint8_t BOUND_UPPER{2};
+    // best move of an entry that has none, packed moves are (placement << 4) | selection
+    constexpr static uint16_t NO_MOVE{0x100};
+
+    struct entry
+    {
+        __uint128_t state;
+        uint8_t selection;
+        int8_t value;
+        uint8_t depth;
+        uint8_t bound;
+        uint16_t best_move = NO_MOVE;
+    };
+
+    explicit transposition_table(size_t size_mb = DEFAULT_TRANSPOSITION_TABLE_MB);
+
+    /**
+     * @return true and writes the entry if the (state, selection) pair is in the table
+     */
+    bool probe(__uint128_t state, uint8_t selection, entry& result) const;
+
+    /**
+     * Stores the value, when the bucket is full the entry of an older search or the one with the lowest depth is
+     * replaced. An existing entry for the same key is only overwritten by a result of at least the same depth, and
+     * keeps its best move when the new result has none.
+     */
+    void store(__uint128_t state, uint8_t selection, int value, uint8_t depth, uint8_t bound = BOUND_EXACT,
+               uint16_t best_move = NO_MOVE);
+
+    /**
+     * Entries stored from now on are preferred over the ones stored before when a bucket is full
+     */
+    void new_generation();
+
+    /**
+     * Reallocates the table, not safe to call while a search is running
+     */
+    void resize(size_t size_mb);
+    void clear();
+
+    void for_each(const std::function<void(const entry&)>& callback) const;
+    void erase_if(const std::function<bool(const entry&)>& predicate);
+
+    [[nodiscard]] size_t get_size() const;
+    [[nodiscard]] size_t get_capacity() const;
+
+private:
+    struct alignas(64) bucket
+    {
+        std::atomic<uint64_t> keys[ENTRIES_PER_BUCKET];
+        std::atomic<uint64_t> data[ENTRIES_PER_BUCKET];
+    };
+
+    static_assert(sizeof(bucket) == 64);
+
+    std::unique_ptr<bucket[]> buckets;
+    size_t bucket_mask = 0;
+    std::atomic<uint8_t> generation{0};
+    // occupied entries, counted when an empty entry is claimed so get_size doesn't have to scan the buckets
+    std::atomic<size_t> size{0};
+
+    [[nodiscard]] bucket& get_bucket(__uint128_t state, uint8_t selection) const;
+    static entry to_entry(uint64_t key_word, uint64_t data);
+};
+
+
+#endif //SHMINIMAXING_TRANSPOSITION_TABLE_H
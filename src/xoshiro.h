@@ -0,0 +1,58 @@
+#ifndef SHMINIMAXING_XOSHIRO_H
+#define SHMINIMAXING_XOSHIRO_H
+
+#include <bit>
+#include <cstdint>
+
+namespace quarto
+{
+    /**
+     * xoshiro256** generator, a few instructions per number and no shared state, so every thread keeps its own
+     */
+    class xoshiro256
+    {
+        uint64_t s[4];
+
+    public:
+        /**
+         * Expands the seed with splitmix64, so seeds that are close give unrelated sequences
+         */
+        explicit xoshiro256(uint64_t seed)
+        {
+            for (auto& word : s)
+            {
+                seed += 0x9e3779b97f4a7c15;
+                uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+                word = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t next()
+        {
+            const uint64_t result = std::rotl(s[1] * 5, 7) * 9;
+            const uint64_t t = s[1] << 17;
+
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = std::rotl(s[3], 45);
+
+            return result;
+        }
+
+        /**
+         * @return a number in [0, bound), bound must be at most 2^32
+         */
+        uint32_t below(const uint64_t bound)
+        {
+            // multiply shift instead of a modulo, the bias is far below anything a playout can notice
+            return static_cast<uint32_t>(((next() >> 32) * bound) >> 32);
+        }
+    };
+} // quarto
+
+#endif //SHMINIMAXING_XOSHIRO_H